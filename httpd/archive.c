@@ -0,0 +1,703 @@
+#include "httpd.h"
+
+
+#define TAR_BLOCK           512
+#define TAR_SIZE_MAX        077777777777ULL     // 11 octal digits
+#define ZIP_MAX16           0xFFFF
+#define ZIP_MAX32           0xFFFFFFFFULL
+#define ZIP_FLAG_DESCRIPTOR 0x0008
+#define ZIP_FLAG_UTF8       0x0800
+#define ZIP_VERSION         20
+#define ZIP_VERSION_64      45
+#define ARCHIVE_HEAD_SIZE   (ARCHIVE_SMALL_FILE + 4 * 1024)
+
+typedef enum
+{
+    ARCHIVE_ENTRY           = 0,    // next entry of the walk
+    ARCHIVE_BODY,                   // large file, read or sent as spans
+    ARCHIVE_DONE
+} archive_state_t;
+
+struct archive_t
+{
+    uint64_t                offset;     // archive bytes generated so far
+    uint64_t                size;       // of the current file
+    uint64_t                done;       // bytes of the current file generated
+    uint64_t                local;      // zip: offset of the local header of the current file
+    uint64_t                count;      // zip: central directory records
+    HANDLE                  file;       // current large file
+    HANDLE                  find[ARCHIVE_DEPTH];
+    uint32_t                dirlen[ARCHIVE_DEPTH];  // length of path up to the entries of each level
+    uint32_t                depth;
+    uint32_t                base;       // length of the archived directory in path
+    uint32_t                crc;
+    uint32_t                dostime;    // zip: date << 16 | time
+    uint8_t                 format;     // archive_format_t
+    uint8_t                 state;      // archive_state_t
+    uint8_t                 pending;    // find[depth - 1] holds an entry not walked yet
+    char                   *out;        // generated bytes not taken yet, head or cd
+    uint32_t                out_len;
+    uint32_t                out_off;
+    char                   *head;       // headers, small files and trailers
+    char                   *cd;         // zip: central directory, written at the end
+    uint32_t                cd_len;
+    uint32_t                cd_cap;
+    WIN32_FIND_DATAA        data;
+    char                    path[MAX_PATH];
+    char                    name[ARCHIVE_NAME_MAX];
+};
+
+uint32_t _archive_crc[256];
+uint8_t  _archive_crc_ready = 0;
+
+static int  archive_walk(archive_t *a);
+static int  archive_next(archive_t *a);
+static void archive_entry_end(archive_t *a);
+static void archive_end(archive_t *a);
+static uint32_t read_small(archive_t *a, HANDLE file, char *buf);
+static uint32_t tar_header(archive_t *a, char *p, uint64_t size, char type, uint64_t mtime);
+static uint32_t tar_pax(char *p, const char *key, const char *value);
+static void tar_octal(char *field, uint32_t width, uint64_t v);
+static uint32_t zip_local(archive_t *a, char *p, uint16_t flags, int zip64);
+static ret_code_t zip_central(archive_t *a, uint16_t flags, uint64_t size, int dir);
+static char *put16(char *p, uint16_t v);
+static char *put32(char *p, uint32_t v);
+static char *put64(char *p, uint64_t v);
+static uint32_t crc32_update(uint32_t crc, const char *data, uint32_t size);
+
+archive_t *archive_open(const char *dir, archive_format_t format)
+{
+    archive_t *a = NULL;
+    uint32_t i, j;
+
+    if (!_archive_crc_ready)
+    {
+        for (i=0; i<256; i++)
+        {
+            _archive_crc[i] = i;
+            for (j=0; j<8; j++)
+            {
+                _archive_crc[i] = (_archive_crc[i] >> 1) ^ (_archive_crc[i] & 1 ? 0xEDB88320 : 0);
+            }
+        }
+        _archive_crc_ready = 1;
+    }
+    if (strlen(dir) + 2 > MAX_PATH)
+        return NULL;
+    a = (archive_t*)malloc(sizeof(archive_t));
+    if (!a)
+    {
+        log_error("{%s:%d} malloc failed", __FUNCTION__, __LINE__);
+        return NULL;
+    }
+    memset(a, 0, sizeof(archive_t));
+    a->format = (uint8_t)format;
+    a->file = INVALID_HANDLE_VALUE;
+    a->head = (char*)malloc(ARCHIVE_HEAD_SIZE);
+    if (!a->head)
+    {
+        log_error("{%s:%d} malloc failed", __FUNCTION__, __LINE__);
+        free(a);
+        return NULL;
+    }
+
+    // dir ends with '/', member names are relative to it
+    a->base = strlen(dir);
+    memcpy(a->path, dir, a->base);
+    memcpy(a->path + a->base, "*", 2);
+    a->find[0] = FindFirstFileA(a->path, &a->data);
+    if (a->find[0] == INVALID_HANDLE_VALUE)
+    {
+        log_error("{%s:%d} list [%s] failed. GetLastError=%d", __FUNCTION__, __LINE__, dir, GetLastError());
+        archive_close(a);
+        return NULL;
+    }
+    a->dirlen[0] = a->base;
+    a->depth = 1;
+    a->pending = 1;
+    return a;
+}
+
+ret_code_t archive_read(archive_t *a, char *buf, uint32_t size, uint32_t *len, archive_span_t *span)
+{
+    LARGE_INTEGER now;
+    uint64_t remain;
+    uint32_t n;
+    DWORD got = 0;
+
+    *len = 0;
+    span->length = 0;
+    while (*len < size)
+    {
+        if (a->out_off < a->out_len)
+        {
+            n = a->out_len - a->out_off < size - *len ? a->out_len - a->out_off : size - *len;
+            memcpy(buf + *len, a->out + a->out_off, n);
+            a->out_off += n;
+            *len += n;
+            continue;
+        }
+        if (a->state == ARCHIVE_DONE)
+            break;
+        a->out = a->head;
+        a->out_len = a->out_off = 0;
+        if (a->state == ARCHIVE_ENTRY)
+        {
+            if (!archive_next(a))
+                archive_end(a);
+            continue;
+        }
+
+        // ARCHIVE_BODY
+        remain = a->size - a->done;
+        if (!remain)
+        {
+            archive_entry_end(a);
+            continue;
+        }
+        if (a->format == ARCHIVE_TAR)
+        {
+            // the size is in the stream already, a shorter file would break the chunk that carries it
+            if (!GetFileSizeEx(a->file, &now) || (uint64_t)now.QuadPart < a->size)
+            {
+                log_error("{%s:%d} [%s] shrank while archived. GetLastError=%d", __FUNCTION__, __LINE__, a->name, GetLastError());
+                return FAIL;
+            }
+            // the bytes before it go out as the head of the same send
+            span->file = a->file;
+            span->offset = a->done;
+            span->length = remain < size - *len ? (uint32_t)remain : size - *len;
+            a->done += span->length;
+            a->offset += span->length;
+            break;
+        }
+        n = remain < size - *len ? (uint32_t)remain : size - *len;
+        if (!ReadFile(a->file, buf + *len, n, &got, NULL) || got != n)
+        {
+            // the size is in the stream already, the archive cannot be completed
+            log_error("{%s:%d} read [%s] failed. GetLastError=%d", __FUNCTION__, __LINE__, a->name, GetLastError());
+            return FAIL;
+        }
+        a->crc = crc32_update(a->crc, buf + *len, n);
+        a->done += n;
+        a->offset += n;
+        *len += n;
+    }
+    return SUCC;
+}
+
+void archive_close(archive_t *a)
+{
+    if (!a)
+        return;
+    while (a->depth)
+    {
+        FindClose(a->find[--a->depth]);
+    }
+    if (a->file != INVALID_HANDLE_VALUE)
+        CloseHandle(a->file);
+    free(a->head);
+    free(a->cd);
+    free(a);
+}
+
+static int archive_walk(archive_t *a)
+{
+    WIN32_FIND_DATAA *d = &a->data;
+    uint32_t level;
+    uint32_t len;
+
+    while (a->depth)
+    {
+        level = a->depth - 1;
+        if (a->pending)
+        {
+            a->pending = 0;
+        }
+        else if (!FindNextFileA(a->find[level], d))
+        {
+            FindClose(a->find[level]);
+            a->depth--;
+            continue;
+        }
+        if (0 == strcmp(d->cFileName, ".") || 0 == strcmp(d->cFileName, ".."))
+            continue;
+        // links may loop, upload state and blobs are not content
+        if (d->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY && (d->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT
+            || 0 == strcmp(d->cFileName, UPLOAD_SESSION_DIR) || 0 == strcmp(d->cFileName, UPLOAD_BLOB_DIR)))
+            continue;
+        len = a->dirlen[level] + strlen(d->cFileName);
+        if (len + 3 > MAX_PATH)
+            continue;
+        memcpy(a->path + a->dirlen[level], d->cFileName, strlen(d->cFileName) + 1);
+        return 1;
+    }
+    return 0;
+}
+
+static int archive_next(archive_t *a)
+{
+    LARGE_INTEGER size;
+    FILETIME local;
+    WORD date, time;
+    HANDLE file;
+    char *utf8 = NULL;
+    char *p = a->head;
+    uint64_t mtime;
+    uint32_t len, n;
+    int dir;
+
+    while (archive_walk(a))
+    {
+        dir = !!(a->data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+        utf8 = ansi_to_utf8(a->path + a->base);
+        len = utf8 ? strlen(utf8) : ARCHIVE_NAME_MAX;
+        if (len + 2 > ARCHIVE_NAME_MAX)
+        {
+            free(utf8);
+            continue;
+        }
+        memcpy(a->name, utf8, len + 1);
+        free(utf8);
+        if (dir)
+            memcpy(a->name + len, "/", 2);
+
+        // taken before a->data moves on to the entries of a directory
+        mtime = ((uint64_t)a->data.ftLastWriteTime.dwHighDateTime << 32) | a->data.ftLastWriteTime.dwLowDateTime;
+        mtime = mtime > 116444736000000000ULL ? (mtime - 116444736000000000ULL) / 10000000 : 0;
+        FileTimeToLocalFileTime(&a->data.ftLastWriteTime, &local);
+        FileTimeToDosDateTime(&local, &date, &time);
+        a->dostime = (uint32_t)date << 16 | time;
+
+        file = INVALID_HANDLE_VALUE;
+        size.QuadPart = 0;
+        if (!dir)
+        {
+            file = CreateFileA(a->path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+            if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size))
+            {
+                // locked or gone since it was listed
+                log_warn("{%s:%d} skip [%s]. GetLastError=%d", __FUNCTION__, __LINE__, a->path, GetLastError());
+                if (file != INVALID_HANDLE_VALUE)
+                    CloseHandle(file);
+                continue;
+            }
+        }
+        else if (a->depth < ARCHIVE_DEPTH)
+        {
+            // entries of the directory follow it
+            len = strlen(a->path);
+            memcpy(a->path + len, "/*", 3);
+            a->find[a->depth] = FindFirstFileA(a->path, &a->data);
+            if (a->find[a->depth] != INVALID_HANDLE_VALUE)
+            {
+                a->dirlen[a->depth++] = len + 1;
+                a->pending = 1;
+            }
+        }
+        a->size = size.QuadPart;
+        a->done = 0;
+        a->crc = 0;
+        a->file = INVALID_HANDLE_VALUE;
+
+        if (a->format == ARCHIVE_TAR)
+        {
+            p += tar_header(a, p, a->size, dir ? '5' : '0', mtime);
+            if (dir)
+                break;
+            if (a->size <= ARCHIVE_SMALL_FILE)
+            {
+                // body and padding join the header, many small files fill one send
+                n = read_small(a, file, p);
+                CloseHandle(file);
+                memset(p + n, 0, (TAR_BLOCK - n % TAR_BLOCK) % TAR_BLOCK);
+                p += (n + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+                break;
+            }
+            a->file = file;
+            a->state = ARCHIVE_BODY;
+            break;
+        }
+
+        a->local = a->offset;
+        if (dir || a->size <= ARCHIVE_SMALL_FILE)
+        {
+            // sizes and crc are known before the header is written
+            len = zip_local(a, p, ZIP_FLAG_UTF8, 0);
+            n = 0;
+            if (!dir)
+            {
+                n = read_small(a, file, p + len);
+                CloseHandle(file);
+                a->crc = crc32_update(0, p + len, n);
+                put32(p + 14, a->crc);
+                put32(p + 18, n);
+                put32(p + 22, n);
+            }
+            p += len + n;
+            zip_central(a, ZIP_FLAG_UTF8, n, dir);
+            break;
+        }
+        // crc and sizes follow the data in a descriptor
+        p += zip_local(a, p, ZIP_FLAG_UTF8 | ZIP_FLAG_DESCRIPTOR, a->size >= ZIP_MAX32);
+        a->file = file;
+        a->state = ARCHIVE_BODY;
+        break;
+    }
+    a->out_len = p - a->head;
+    a->offset += a->out_len;
+    return a->out_len || a->state == ARCHIVE_BODY;
+}
+
+static void archive_entry_end(archive_t *a)
+{
+    char *p = a->head;
+    int zip64 = a->size >= ZIP_MAX32;
+
+    CloseHandle(a->file);
+    a->file = INVALID_HANDLE_VALUE;
+    if (a->format == ARCHIVE_TAR)
+    {
+        memset(p, 0, TAR_BLOCK);
+        p += (TAR_BLOCK - a->size % TAR_BLOCK) % TAR_BLOCK;
+    }
+    else
+    {
+        p = put32(p, 0x08074b50);
+        p = put32(p, a->crc);
+        if (zip64)
+        {
+            p = put64(p, a->size);
+            p = put64(p, a->size);
+        }
+        else
+        {
+            p = put32(p, (uint32_t)a->size);
+            p = put32(p, (uint32_t)a->size);
+        }
+        zip_central(a, ZIP_FLAG_UTF8 | ZIP_FLAG_DESCRIPTOR, a->size, 0);
+    }
+    a->out_len = p - a->head;
+    a->offset += a->out_len;
+    a->state = ARCHIVE_ENTRY;
+}
+
+static void archive_end(archive_t *a)
+{
+    char *p = a->head;
+    uint64_t cd_offset = a->offset;
+    char *cd = NULL;
+    uint32_t len;
+
+    a->state = ARCHIVE_DONE;
+    if (a->format == ARCHIVE_TAR)
+    {
+        // two zero blocks
+        memset(p, 0, 2 * TAR_BLOCK);
+        a->out_len = 2 * TAR_BLOCK;
+        a->offset += a->out_len;
+        return;
+    }
+
+    if (a->count >= ZIP_MAX16 || cd_offset >= ZIP_MAX32)
+    {
+        p = put32(p, 0x06064b50);
+        p = put64(p, 44);
+        p = put16(p, ZIP_VERSION_64);
+        p = put16(p, ZIP_VERSION_64);
+        p = put32(p, 0);
+        p = put32(p, 0);
+        p = put64(p, a->count);
+        p = put64(p, a->count);
+        p = put64(p, a->cd_len);
+        p = put64(p, cd_offset);
+        // locator of the record above
+        p = put32(p, 0x07064b50);
+        p = put32(p, 0);
+        p = put64(p, cd_offset + a->cd_len);
+        p = put32(p, 1);
+    }
+    p = put32(p, 0x06054b50);
+    p = put16(p, 0);
+    p = put16(p, 0);
+    p = put16(p, (uint16_t)(a->count >= ZIP_MAX16 ? ZIP_MAX16 : a->count));
+    p = put16(p, (uint16_t)(a->count >= ZIP_MAX16 ? ZIP_MAX16 : a->count));
+    p = put32(p, a->cd_len);
+    p = put32(p, (uint32_t)(cd_offset >= ZIP_MAX32 ? ZIP_MAX32 : cd_offset));
+    p = put16(p, 0);
+    len = p - a->head;
+
+    // the end records follow the central directory
+    if (a->cd_len + len > a->cd_cap)
+    {
+        cd = (char*)realloc(a->cd, a->cd_len + len);
+        if (!cd)
+        {
+            log_error("{%s:%d} realloc failed", __FUNCTION__, __LINE__);
+            a->out_len = 0;
+            return;
+        }
+        a->cd = cd;
+        a->cd_cap = a->cd_len + len;
+    }
+    memcpy(a->cd + a->cd_len, a->head, len);
+    a->out = a->cd;
+    a->out_len = a->cd_len + len;
+    a->offset += a->out_len;
+}
+
+static uint32_t read_small(archive_t *a, HANDLE file, char *buf)
+{
+    DWORD got = 0;
+
+    // a file that shrank since its size was taken is padded with zeros
+    if (!ReadFile(file, buf, (DWORD)a->size, &got, NULL))
+        got = 0;
+    if (got < a->size)
+    {
+        log_warn("{%s:%d} [%s] changed while archived", __FUNCTION__, __LINE__, a->name);
+        memset(buf + got, 0, (size_t)(a->size - got));
+    }
+    return (uint32_t)a->size;
+}
+
+static uint32_t tar_header(archive_t *a, char *p, uint64_t size, char type, uint64_t mtime)
+{
+    const char *name = a->name;
+    uint32_t len = strlen(a->name);
+    uint32_t records = 0;
+    uint32_t sum = 0;
+    uint32_t split = 0;
+    uint32_t n = 0;
+    char value[24];
+    char *h = NULL;
+    int i;
+
+    // ustar splits a long name at a '/' into prefix and name
+    if (len > 100)
+    {
+        for (i=len-2; i>0; i--)
+        {
+            if (name[i] == '/' && len - i - 1 <= 100 && i <= 155)
+            {
+                split = i;
+                break;
+            }
+        }
+    }
+    if ((len > 100 && !split) || size > TAR_SIZE_MAX)
+    {
+        // pax extended header ahead of the entry
+        records = TAR_BLOCK;
+        if (len > 100 && !split)
+            records += tar_pax(p + records, "path", name);
+        if (size > TAR_SIZE_MAX)
+        {
+            uint64_to_buf(size, value);
+            records += tar_pax(p + records, "size", value);
+        }
+        n = records - TAR_BLOCK;
+        memset(p + records, 0, (TAR_BLOCK - n % TAR_BLOCK) % TAR_BLOCK);
+        records += (TAR_BLOCK - n % TAR_BLOCK) % TAR_BLOCK;
+        memset(p, 0, TAR_BLOCK);
+        memcpy(p, "PaxHeader", sizeof("PaxHeader") - 1);
+        tar_octal(p + 100, 8, 0644);
+        tar_octal(p + 108, 8, 0);
+        tar_octal(p + 116, 8, 0);
+        tar_octal(p + 124, 12, n);
+        tar_octal(p + 136, 12, mtime);
+        p[156] = 'x';
+        memcpy(p + 257, "ustar", 6);
+        memcpy(p + 263, "00", 2);
+        memset(p + 148, ' ', 8);
+        for (i=0; i<TAR_BLOCK; i++)
+        {
+            sum += (uint8_t)p[i];
+        }
+        sprintf(p + 148, "%06o", sum);
+        p[155] = ' ';
+        sum = 0;
+    }
+
+    h = p + records;
+    memset(h, 0, TAR_BLOCK);
+    if (split)
+    {
+        memcpy(h + 345, name, split);
+        memcpy(h, name + split + 1, len - split - 1);
+    }
+    else
+    {
+        memcpy(h, name, len > 100 ? 100 : len);
+    }
+    tar_octal(h + 100, 8, type == '5' ? 0755 : 0644);
+    tar_octal(h + 108, 8, 0);
+    tar_octal(h + 116, 8, 0);
+    tar_octal(h + 124, 12, size > TAR_SIZE_MAX ? 0 : size);
+    tar_octal(h + 136, 12, mtime);
+    h[156] = type;
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+    memset(h + 148, ' ', 8);
+    for (i=0; i<TAR_BLOCK; i++)
+    {
+        sum += (uint8_t)h[i];
+    }
+    sprintf(h + 148, "%06o", sum);
+    h[155] = ' ';
+    return records + TAR_BLOCK;
+}
+
+static uint32_t tar_pax(char *p, const char *key, const char *value)
+{
+    uint32_t len = strlen(key) + strlen(value) + 3;    // ' ', '=' and '\n'
+    uint32_t total = 0;
+    uint32_t n = len + 1;
+    uint32_t m;
+
+    // "<length> key=value\n", the length counts its own digits
+    while (total != n)
+    {
+        total = n;
+        for (n=len, m=total; m; m/=10)
+        {
+            n++;
+        }
+    }
+    return sprintf(p, "%u %s=%s\n", total, key, value);
+}
+
+static void tar_octal(char *field, uint32_t width, uint64_t v)
+{
+    int i;
+
+    // zero padded, NUL terminated
+    field[width - 1] = 0;
+    for (i=width-2; i>=0; i--)
+    {
+        field[i] = '0' + (char)(v & 7);
+        v >>= 3;
+    }
+}
+
+static uint32_t zip_local(archive_t *a, char *p, uint16_t flags, int zip64)
+{
+    char *s = p;
+    uint16_t len = (uint16_t)strlen(a->name);
+
+    p = put32(p, 0x04034b50);
+    p = put16(p, zip64 ? ZIP_VERSION_64 : ZIP_VERSION);
+    p = put16(p, flags);
+    p = put16(p, 0);                    // stored
+    p = put32(p, a->dostime);
+    p = put32(p, 0);                    // crc
+    p = put32(p, zip64 ? (uint32_t)ZIP_MAX32 : 0);
+    p = put32(p, zip64 ? (uint32_t)ZIP_MAX32 : 0);
+    p = put16(p, len);
+    p = put16(p, zip64 ? 20 : 0);
+    memcpy(p, a->name, len);
+    p += len;
+    if (zip64)
+    {
+        // sizes follow in the descriptor
+        p = put16(p, 0x0001);
+        p = put16(p, 16);
+        p = put64(p, 0);
+        p = put64(p, 0);
+    }
+    return p - s;
+}
+
+static ret_code_t zip_central(archive_t *a, uint16_t flags, uint64_t size, int dir)
+{
+    uint16_t len = (uint16_t)strlen(a->name);
+    uint16_t extra = 0;
+    char *cd = NULL;
+    char *p = NULL;
+    uint32_t cap;
+
+    if (size >= ZIP_MAX32)
+        extra += 16;
+    if (a->local >= ZIP_MAX32)
+        extra += 8;
+    if (extra)
+        extra += 4;
+    if (a->cd_len + 46 + len + extra > a->cd_cap)
+    {
+        cap = a->cd_cap ? a->cd_cap * 2 : 64 * 1024;
+        while (cap < a->cd_len + 46 + len + extra)
+            cap *= 2;
+        cd = (char*)realloc(a->cd, cap);
+        if (!cd)
+        {
+            log_error("{%s:%d} realloc failed", __FUNCTION__, __LINE__);
+            return FAIL;
+        }
+        a->cd = cd;
+        a->cd_cap = cap;
+    }
+    p = a->cd + a->cd_len;
+    p = put32(p, 0x02014b50);
+    p = put16(p, ZIP_VERSION_64);       // made by, ms-dos attributes
+    p = put16(p, extra ? ZIP_VERSION_64 : ZIP_VERSION);
+    p = put16(p, flags);
+    p = put16(p, 0);
+    p = put32(p, a->dostime);
+    p = put32(p, a->crc);
+    p = put32(p, (uint32_t)(size >= ZIP_MAX32 ? ZIP_MAX32 : size));
+    p = put32(p, (uint32_t)(size >= ZIP_MAX32 ? ZIP_MAX32 : size));
+    p = put16(p, len);
+    p = put16(p, extra);
+    p = put16(p, 0);                    // comment
+    p = put16(p, 0);                    // disk
+    p = put16(p, 0);                    // internal attributes
+    p = put32(p, dir ? FILE_ATTRIBUTE_DIRECTORY : 0);
+    p = put32(p, (uint32_t)(a->local >= ZIP_MAX32 ? ZIP_MAX32 : a->local));
+    memcpy(p, a->name, len);
+    p += len;
+    if (extra)
+    {
+        p = put16(p, 0x0001);
+        p = put16(p, extra - 4);
+        if (size >= ZIP_MAX32)
+        {
+            p = put64(p, size);
+            p = put64(p, size);
+        }
+        if (a->local >= ZIP_MAX32)
+            p = put64(p, a->local);
+    }
+    a->cd_len = p - a->cd;
+    a->count++;
+    return SUCC;
+}
+
+static char *put16(char *p, uint16_t v)
+{
+    p[0] = (char)v;
+    p[1] = (char)(v >> 8);
+    return p + 2;
+}
+
+static char *put32(char *p, uint32_t v)
+{
+    p = put16(p, (uint16_t)v);
+    return put16(p, (uint16_t)(v >> 16));
+}
+
+static char *put64(char *p, uint64_t v)
+{
+    p = put32(p, (uint32_t)v);
+    return put32(p, (uint32_t)(v >> 32));
+}
+
+static uint32_t crc32_update(uint32_t crc, const char *data, uint32_t size)
+{
+    crc = ~crc;
+    while (size--)
+    {
+        crc = _archive_crc[(crc ^ (uint8_t)*data++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
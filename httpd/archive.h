@@ -0,0 +1,28 @@
+#ifndef __ARCHIVE_H__
+#define __ARCHIVE_H__
+
+#define ARCHIVE_SMALL_FILE      (64 * 1024)     // read whole, many of them fit in one send
+#define ARCHIVE_DEPTH           64              // deeper directories are left out
+#define ARCHIVE_NAME_MAX        1024            // utf-8 member name
+
+typedef enum
+{
+    ARCHIVE_TAR             = 0,    // ustar, pax headers for long names and sizes
+    ARCHIVE_ZIP                     // stored, zip64 when needed
+} archive_format_t;
+
+// a file range the caller sends straight from the file, counted in the size passed to archive_read
+typedef struct
+{
+    HANDLE                  file;
+    uint64_t                offset;
+    uint32_t                length;     // 0 if none
+} archive_span_t;
+
+typedef struct archive_t archive_t;
+
+archive_t *archive_open(const char *dir, archive_format_t format);
+ret_code_t archive_read(archive_t *a, char *buf, uint32_t size, uint32_t *len, archive_span_t *span);
+void       archive_close(archive_t *a);
+
+#endif
\ No newline at end of file
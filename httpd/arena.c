@@ -0,0 +1,133 @@
+#include "httpd.h"
+
+
+#define ARENA_HEAD          ((sizeof(arena_block_t) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define ARENA_DATA(b)       ((char*)(b) + ARENA_HEAD)
+
+struct arena_block_t
+{
+    arena_block_t          *next;
+    uint32_t                size;       // of the data following the aligned head
+};
+
+static arena_block_t *arena_block(arena_t *a, uint32_t size);
+static void arena_release(arena_t *a);
+
+void arena_init(arena_t *a, uint32_t block)
+{
+    memset(a, 0, sizeof(arena_t));
+    a->block = block ? block : ARENA_BLOCK;
+}
+
+void arena_init_inline(arena_t *a, void *first, uint32_t size, uint32_t block)
+{
+    // first is aligned and owned by the caller, it is never freed
+    arena_init(a, block);
+    a->first = (char*)first;
+    a->first_size = size;
+    a->ptr = a->first;
+    a->end = a->first + size;
+}
+
+void *arena_alloc(arena_t *a, uint32_t size)
+{
+    arena_block_t *b = NULL;
+    char *p = NULL;
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if ((uint32_t)(a->end - a->ptr) >= size)
+    {
+        p = a->ptr;
+        a->ptr += size;
+        return p;
+    }
+    if (size > a->block / 4)
+    {
+        // a large allocation gets a block of its own, the current block keeps its free space
+        b = arena_block(a, size);
+        if (!b)
+            return NULL;
+        b->next = a->blocks;
+        a->blocks = b;
+        return ARENA_DATA(b);
+    }
+    b = arena_block(a, a->block);
+    if (!b)
+        return NULL;
+    b->next = a->blocks;
+    a->blocks = b;
+    a->ptr = ARENA_DATA(b) + size;
+    a->end = ARENA_DATA(b) + a->block;
+    return ARENA_DATA(b);
+}
+
+void *arena_grow(arena_t *a, void *p, uint32_t size, uint32_t new_size)
+{
+    char *q = (char*)p;
+    uint32_t used = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    // the last allocation grows in place while its block has room
+    if (q + used == a->ptr && (uint32_t)(a->end - q) >= new_size)
+    {
+        a->ptr = q + ((new_size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1));
+        return q;
+    }
+    q = (char*)arena_alloc(a, new_size);
+    if (q)
+        memcpy(q, p, size);
+    return q;
+}
+
+char *arena_strdup(arena_t *a, const char *str, uint32_t len)
+{
+    char *p = NULL;
+
+    p = (char*)arena_alloc(a, len + 1);
+    if (p)
+    {
+        memcpy(p, str, len);
+        p[len] = 0;
+    }
+    return p;
+}
+
+void arena_reset(arena_t *a)
+{
+    arena_release(a);
+    a->ptr = a->first;
+    a->end = a->first ? a->first + a->first_size : NULL;
+}
+
+void arena_free(arena_t *a)
+{
+    arena_release(a);
+    a->ptr = a->end = NULL;
+}
+
+static arena_block_t *arena_block(arena_t *a, uint32_t size)
+{
+    arena_block_t *b = NULL;
+
+    b = (arena_block_t*)malloc(ARENA_HEAD + size);
+    if (!b)
+    {
+        log_error("{%s:%d} malloc failed", __FUNCTION__, __LINE__);
+        return NULL;
+    }
+    b->next = NULL;
+    b->size = size;
+    a->size += ARENA_HEAD + size;
+    return b;
+}
+
+static void arena_release(arena_t *a)
+{
+    arena_block_t *b = NULL;
+
+    while ((b = a->blocks))
+    {
+        a->blocks = b->next;
+        free(b);
+    }
+    a->size = 0;
+}
\ No newline at end of file
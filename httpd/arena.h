@@ -0,0 +1,29 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#define ARENA_BLOCK             (64 * 1024)     // default size of the blocks an arena grows by
+#define ARENA_ALIGN             8
+
+typedef struct arena_block_t arena_block_t;
+
+// bump allocator, everything is freed at once
+typedef struct
+{
+    arena_block_t          *blocks;     // current block first
+    char                   *ptr;        // free space of the current block
+    char                   *end;
+    char                   *first;      // inline block of the owner, used again after a reset
+    uint32_t                first_size;
+    uint32_t                block;      // size of new blocks
+    uint32_t                size;       // bytes taken from the system
+} arena_t;
+
+void  arena_init(arena_t *a, uint32_t block);
+void  arena_init_inline(arena_t *a, void *first, uint32_t size, uint32_t block);
+void *arena_alloc(arena_t *a, uint32_t size);
+void *arena_grow(arena_t *a, void *p, uint32_t size, uint32_t new_size);
+char *arena_strdup(arena_t *a, const char *str, uint32_t len);
+void  arena_reset(arena_t *a);
+void  arena_free(arena_t *a);
+
+#endif
\ No newline at end of file
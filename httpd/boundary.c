@@ -0,0 +1,116 @@
+#include "httpd.h"
+
+
+boundary_t *boundary_create(const char *value)
+{
+    boundary_t *b = NULL;
+    const char *end = NULL;
+    uint32_t len;
+    uint32_t i;
+
+    // boundary=xxx or boundary="xxx", other parameters may follow
+    if (*value == '"')
+    {
+        value++;
+        end = strchr(value, '"');
+        if (!end)
+            return NULL;
+    }
+    else
+    {
+        for (end = value; *end && *end != ';' && *end != ' ' && *end != '\t'; end++);
+    }
+    len = end - value;
+    if (len == 0 || len > BOUNDARY_MAX_LEN)
+    {
+        log_error("{%s:%d} invalid boundary length %u", __FUNCTION__, __LINE__, len);
+        return NULL;
+    }
+
+    b = (boundary_t*)malloc(sizeof(boundary_t));
+    if (!b)
+    {
+        log_error("{%s:%d} malloc failed", __FUNCTION__, __LINE__);
+        return NULL;
+    }
+    memcpy(b->delim, "\r\n--", 4);
+    memcpy(b->delim + 4, value, len);
+    b->delim[len + 4] = 0;
+    b->length = (uint8_t)(len + 4);
+
+    // shift by the distance of the last occurrence from the end
+    memset(b->skip, b->length, sizeof(b->skip));
+    for (i=0; i<(uint32_t)b->length-1; i++)
+    {
+        b->skip[(uint8_t)b->delim[i]] = (uint8_t)(b->length - 1 - i);
+    }
+    return b;
+}
+
+void boundary_free(boundary_t *b)
+{
+    free(b);
+}
+
+int boundary_search(const boundary_t *b, char *data, uint32_t size, char **ptr)
+{
+    const char *delim = b->delim;
+    uint32_t m = b->length;
+    uint32_t i, rest;
+    char *p = NULL;
+
+    // "--boundary" CRLF opens the body
+    if (size >= m && 0 == memcmp(data, delim + 2, m - 2) && 0 == memcmp(data + m - 2, "\r\n", 2))
+    {
+        *ptr = data + m;
+        return BOUNDARY_FIRST;
+    }
+    if (size < m && 0 == memcmp(data, delim + 2, size < m - 2 ? size : m - 2)
+        && (size <= m - 2 || 0 == memcmp(data + m - 2, "\r\n", size - (m - 2))))
+    {
+        // a short read inside the opening delimiter, wait for the rest
+        *ptr = data;
+        return BOUNDARY_PARTIAL;
+    }
+
+    i = 0;
+    while (i + m <= size)
+    {
+        if (data[i + m - 1] == delim[m - 1] && 0 == memcmp(data + i, delim, m - 1))
+        {
+            p = data + i + m;
+            rest = size - i - m;
+            if (rest >= 2 && 0 == memcmp(p, "\r\n", 2))
+            {
+                *ptr = data + i;
+                return BOUNDARY_MIDDLE;
+            }
+            if (rest >= 4 && 0 == memcmp(p, "--\r\n", 4))
+            {
+                *ptr = data + i;
+                return BOUNDARY_LAST;
+            }
+            if ((rest < 2 && 0 == memcmp(p, "\r\n", rest)) || (rest < 4 && 0 == memcmp(p, "--\r\n", rest)))
+            {
+                *ptr = data + i;
+                return BOUNDARY_PARTIAL;
+            }
+        }
+        i += b->skip[(uint8_t)data[i + m - 1]];
+    }
+
+    // a delimiter prefix at the tail is kept for the next read
+    for (i = size >= m ? size - m + 1 : 0; i < size; i++)
+    {
+        p = (char*)memchr(data + i, '\r', size - i);
+        if (!p)
+            break;
+        i = p - data;
+        if (0 == memcmp(p, delim, size - i))
+        {
+            *ptr = p;
+            return BOUNDARY_PARTIAL;
+        }
+    }
+    return BOUNDARY_NONE;
+}
\ No newline at end of file
@@ -0,0 +1,26 @@
+#ifndef __BOUNDARY_H__
+#define __BOUNDARY_H__
+
+#define BOUNDARY_MAX_LEN    70      // rfc 2046
+
+typedef enum
+{
+    BOUNDARY_NONE           = 0,    // no delimiter, every byte is file data
+    BOUNDARY_FIRST,                 // "--boundary" CRLF at the start of the body
+    BOUNDARY_LAST,                  // CRLF "--boundary--"
+    BOUNDARY_MIDDLE,                // CRLF "--boundary" CRLF
+    BOUNDARY_PARTIAL                // delimiter cut by the end of the buffer
+} boundary_match_t;
+
+typedef struct
+{
+    char                    delim[BOUNDARY_MAX_LEN + 5];    // CRLF "--" boundary
+    uint8_t                 length;
+    uint8_t                 skip[256];  // Boyer-Moore-Horspool shift table
+} boundary_t;
+
+boundary_t *boundary_create(const char *value);
+void        boundary_free(boundary_t *b);
+int         boundary_search(const boundary_t *b, char *data, uint32_t size, char **ptr);
+
+#endif
\ No newline at end of file
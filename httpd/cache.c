@@ -0,0 +1,783 @@
+#include "httpd.h"
+#include "tree.h"
+
+
+#define WATCH_FILTER    (FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME \
+                        | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE)
+
+struct cache_node_t {
+    cache_t                 c;          // must be first, cache_t* is cast back to the node
+    RB_ENTRY(cache_node_t)  node;
+    struct cache_node_t    *prev;       // lru list, idle entries only
+    struct cache_node_t    *next;
+    uint8_t                 stale;      // removed from the tree, freed on last close
+    uint32_t                bytes;      // memory counted in _cache_bytes
+};
+RB_HEAD(cache_tree_t, cache_node_t) _cache_tree;
+
+struct cache_node_t *_cache_head = NULL;   // most recently used
+struct cache_node_t *_cache_tail = NULL;   // next to evict
+uint32_t             _cache_idle = 0;
+uint32_t             _cache_bytes = 0;     // content, headers and listings in memory
+
+// change notifications of the root directory, queued by the watch thread
+CRITICAL_SECTION     _watch_lock;
+HANDLE               _watch_dir      = INVALID_HANDLE_VALUE;
+HANDLE               _watch_thread   = NULL;
+volatile LONG        _watch_alive    = 0;
+volatile LONG        _watch_dirty    = 0;
+uint8_t              _watch_overflow = 0;
+uint32_t             _watch_size     = 0;
+char                 _watch_paths[CACHE_WATCH_QUEUE][MAX_PATH];
+uint8_t              _watch_quiet[CACHE_WATCH_QUEUE];   // a modified in-flight file, its listing is left alone
+uint8_t              _watch_actions[CACHE_WATCH_QUEUE]; // FILE_ACTION_*
+
+static int  compare(struct cache_node_t *n1, struct cache_node_t *n2);
+RB_PROTOTYPE(cache_tree_t, cache_node_t, node, compare);
+RB_GENERATE(cache_tree_t, cache_node_t, node, compare);
+static struct cache_node_t *cache_lookup(const char *path);
+static struct cache_node_t *cache_nfind(struct cache_node_t *k);
+static struct cache_node_t *create_cache_node(const char *path);
+static struct cache_node_t *create_dir_node(const char *path);
+static int  load_dir_entries(struct cache_node_t *n, const char *path);
+static int  compare_name(const void *e1, const void *e2);
+static int  compare_size(const void *e1, const void *e2);
+static int  compare_mtime(const void *e1, const void *e2);
+static void release_cache_node(struct cache_node_t *n);
+static void cache_invalidate(struct cache_node_t *n);
+static int  cache_validate(struct cache_node_t *n);
+static void cache_account(struct cache_node_t *n, uint32_t bytes);
+static void cache_trim();
+static void cache_sync();
+static int  watch_quiet(const char *path);
+static DWORD WINAPI watch_proc(LPVOID param);
+static void lru_push(struct cache_node_t *n);
+static void lru_remove(struct cache_node_t *n);
+
+ret_code_t cache_init()
+{
+    RB_INIT(&_cache_tree);
+    _cache_head = NULL;
+    _cache_tail = NULL;
+    _cache_idle = 0;
+    _cache_bytes = 0;
+
+    InitializeCriticalSection(&_watch_lock);
+    _watch_dir = CreateFileA(root_path(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (_watch_dir != INVALID_HANDLE_VALUE)
+    {
+        _watch_alive = 1;
+        _watch_thread = CreateThread(NULL, 0, watch_proc, NULL, 0, NULL);
+    }
+    if (!_watch_thread)
+    {
+        _watch_alive = 0;
+        // cached content is validated by a stat on every hit instead
+        log_warn("{%s:%d} cannot watch [%s]. GetLastError=%d", __FUNCTION__, __LINE__, root_path(), GetLastError());
+    }
+    return SUCC;
+}
+
+ret_code_t cache_uninit()
+{
+    struct cache_node_t *n = NULL;
+
+    if (_watch_thread)
+    {
+        CancelSynchronousIo(_watch_thread);
+        WaitForSingleObject(_watch_thread, INFINITE);
+        CloseHandle(_watch_thread);
+        _watch_thread = NULL;
+    }
+    if (_watch_dir != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(_watch_dir);
+        _watch_dir = INVALID_HANDLE_VALUE;
+    }
+    DeleteCriticalSection(&_watch_lock);
+
+    while ((n = RB_MIN(cache_tree_t, &_cache_tree)))
+    {
+        RB_REMOVE(cache_tree_t, &_cache_tree, n);
+        release_cache_node(n);
+    }
+    _cache_head = NULL;
+    _cache_tail = NULL;
+    _cache_idle = 0;
+    return SUCC;
+}
+
+cache_t *cache_open(const char *path)
+{
+    struct cache_node_t *n = NULL;
+
+    n = cache_lookup(path);
+    if (n)
+    {
+        return &n->c;
+    }
+
+    n = create_cache_node(path);
+    if (!n)
+    {
+        return NULL;
+    }
+    RB_INSERT(cache_tree_t, &_cache_tree, n);
+    n->c.refs = 1;
+    cache_trim();
+    return &n->c;
+}
+
+cache_t *cache_open_dir(const char *path)
+{
+    struct cache_node_t *n = NULL;
+
+    n = cache_lookup(path);
+    if (n)
+    {
+        return &n->c;
+    }
+
+    n = create_dir_node(path);
+    if (!n)
+    {
+        return NULL;
+    }
+    RB_INSERT(cache_tree_t, &_cache_tree, n);
+    n->c.refs = 1;
+    cache_trim();
+    return &n->c;
+}
+
+void cache_close(cache_t *c)
+{
+    struct cache_node_t *n = (struct cache_node_t *)c;
+
+    ASSERT(n->c.refs > 0);
+    if (--n->c.refs)
+        return;
+    if (n->stale)
+    {
+        release_cache_node(n);
+        return;
+    }
+    lru_push(n);
+    cache_trim();
+}
+
+ret_code_t cache_read(cache_t *c, uint64_t offset, char *buf, uint32_t size)
+{
+    OVERLAPPED ov = { 0 };
+    DWORD readn = 0;
+
+    if (c->content)
+    {
+        memcpy(buf, c->content + offset, size);
+        return SUCC;
+    }
+
+    // positional read, the handle is shared by concurrent transfers
+    ov.Offset = (DWORD)offset;
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+    if (!ReadFile(c->handle, buf, size, &readn, &ov) || readn != size)
+    {
+        log_error("{%s:%d} read [%s] failed. offset=%llu, GetLastError=%d", __FUNCTION__, __LINE__, c->path, offset, GetLastError());
+        return FAIL;
+    }
+    return SUCC;
+}
+
+ret_code_t cache_set_header(cache_t *c, const char *header)
+{
+    uint32_t len = strlen(header);
+
+    ASSERT(!c->header);
+    c->header = (char*)malloc(len + 1);
+    if (!c->header)
+    {
+        log_error("{%s:%d} malloc failed", __FUNCTION__, __LINE__);
+        return FAIL;
+    }
+    memcpy(c->header, header, len + 1);
+    c->header_size = len;
+    cache_account((struct cache_node_t *)c, len);
+    return SUCC;
+}
+
+void cache_set_content(cache_t *c, char *content, uint32_t size)
+{
+    ASSERT(!c->content);
+    c->content = content;
+    c->size = size;
+    cache_account((struct cache_node_t *)c, size);
+}
+
+cache_entry_t **cache_sorted(cache_t *c, cache_sort_t sort)
+{
+    static int (*compares[CACHE_SORT_MAX])(const void*, const void*) = { compare_name, compare_size, compare_mtime };
+    cache_entry_t **sorted = NULL;
+    uint32_t i, j;
+
+    if (c->sorted[sort] || !c->count)
+        return c->sorted[sort];
+
+    // sorted once per listing, every page and repeated request reuse it
+    sorted = (cache_entry_t**)malloc(c->count * sizeof(cache_entry_t*));
+    if (!sorted)
+    {
+        log_error("{%s:%d} malloc failed", __FUNCTION__, __LINE__);
+        return NULL;
+    }
+    for (i = 0, j = 0; i < c->count; i++)
+    {
+        if (c->entries[i].dir && (0 == strcmp(c->entries[i].name, ".") || 0 == strcmp(c->entries[i].name, "..")))
+            continue;
+        sorted[j++] = c->entries + i;
+    }
+    qsort(sorted, j, sizeof(cache_entry_t*), compares[sort]);
+    c->sorted_count = j;
+    c->sorted[sort] = sorted;
+    cache_account((struct cache_node_t *)c, c->count * sizeof(cache_entry_t*));
+    return sorted;
+}
+
+static int compare(struct cache_node_t *n1, struct cache_node_t *n2)
+{
+    // file names are case insensitive
+    return _stricmp(n1->c.path, n2->c.path);
+}
+
+static struct cache_node_t *cache_nfind(struct cache_node_t *k)
+{
+    struct cache_node_t *n = RB_ROOT(&_cache_tree);
+    struct cache_node_t *res = NULL;
+
+    // first node not below k, tree.h has no RB_NFIND
+    while (n)
+    {
+        if (compare(k, n) <= 0)
+        {
+            res = n;
+            n = RB_LEFT(n, node);
+        }
+        else
+        {
+            n = RB_RIGHT(n, node);
+        }
+    }
+    return res;
+}
+
+static struct cache_node_t *cache_lookup(const char *path)
+{
+    struct cache_node_t  k;
+    struct cache_node_t *n = NULL;
+
+    if (strlen(path) >= MAX_PATH)
+    {
+        log_error("{%s:%d} path too long. path=%s", __FUNCTION__, __LINE__, path);
+        return NULL;
+    }
+    cache_sync();
+    memcpy(k.c.path, path, strlen(path) + 1);
+    n = RB_FIND(cache_tree_t, &_cache_tree, &k);
+    if (!n)
+    {
+        return NULL;
+    }
+    if (!cache_validate(n))
+    {
+        log_debug("{%s:%d} file changed, reload. path=%s", __FUNCTION__, __LINE__, path);
+        cache_invalidate(n);
+        return NULL;
+    }
+    if (n->c.refs == 0)
+        lru_remove(n);
+    n->c.refs++;
+    return n;
+}
+
+static struct cache_node_t *create_cache_node(const char *path)
+{
+    struct cache_node_t *n = NULL;
+    BY_HANDLE_FILE_INFORMATION info;
+    HANDLE handle;
+    char *content = NULL;
+    char digest[HASH_DIGEST_LEN] = {0};
+
+    if (strlen(path) >= MAX_PATH)
+    {
+        log_error("{%s:%d} path too long. path=%s", __FUNCTION__, __LINE__, path);
+        return NULL;
+    }
+
+    // FILE_SHARE_DELETE: an upload may replace the file while it is being sent
+    handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        log_error("{%s:%d} open [%s] failed. GetLastError=%d", __FUNCTION__, __LINE__, path, GetLastError());
+        return NULL;
+    }
+    if (!GetFileInformationByHandle(handle, &info))
+    {
+        log_error("{%s:%d} stat [%s] failed. GetLastError=%d", __FUNCTION__, __LINE__, path, GetLastError());
+        CloseHandle(handle);
+        return NULL;
+    }
+    n = (struct cache_node_t *)malloc(sizeof(struct cache_node_t));
+    if (!n)
+    {
+        log_error("{%s:%d} malloc failed", __FUNCTION__, __LINE__);
+        CloseHandle(handle);
+        return NULL;
+    }
+    memset(n, 0, sizeof(struct cache_node_t));
+    memcpy(n->c.path, path, strlen(path));
+    n->c.handle = handle;
+    n->c.size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    n->c.ctime = info.ftCreationTime;
+    n->c.mtime = info.ftLastWriteTime;
+    n->c.mime = mime_type(path);
+    if (SUCC == hash_load(path, n->c.size, digest))
+    {
+        n->c.digest = (char*)malloc(strlen(digest) + 1);
+        if (n->c.digest)
+            memcpy(n->c.digest, digest, strlen(digest) + 1);
+    }
+
+    if (info.nFileSizeHigh == 0 && info.nFileSizeLow <= CACHE_CONTENT_MAX)
+    {
+        // small file: keep the whole content, hits are served from memory
+        content = (char*)malloc(info.nFileSizeLow + 1);
+        if (content && SUCC == cache_read(&n->c, 0, content, info.nFileSizeLow))
+        {
+            CloseHandle(handle);
+            n->c.handle = INVALID_HANDLE_VALUE;
+            n->c.content = content;
+            cache_account(n, info.nFileSizeLow);
+        }
+        else
+        {
+            free(content);
+        }
+    }
+    return n;
+}
+
+static struct cache_node_t *create_dir_node(const char *path)
+{
+    struct cache_node_t *n = NULL;
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+
+    if (strlen(path) + 1 >= MAX_PATH)
+    {
+        log_error("{%s:%d} path too long. path=%s", __FUNCTION__, __LINE__, path);
+        return NULL;
+    }
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &attr) || !(attr.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+    {
+        log_error("{%s:%d} [%s] is not a directory. GetLastError=%d", __FUNCTION__, __LINE__, path, GetLastError());
+        return NULL;
+    }
+    n = (struct cache_node_t *)malloc(sizeof(struct cache_node_t));
+    if (!n)
+    {
+        log_error("{%s:%d} malloc failed", __FUNCTION__, __LINE__);
+        return NULL;
+    }
+    memset(n, 0, sizeof(struct cache_node_t));
+    memcpy(n->c.path, path, strlen(path));
+    n->c.handle = INVALID_HANDLE_VALUE;
+    n->c.dir = 1;
+    n->c.ctime = attr.ftCreationTime;
+    n->c.mtime = attr.ftLastWriteTime;
+    arena_init(&n->c.names, 0);
+
+    if (SUCC != load_dir_entries(n, path))
+    {
+        release_cache_node(n);
+        return NULL;
+    }
+    return n;
+}
+
+static int load_dir_entries(struct cache_node_t *n, const char *path)
+{
+    WIN32_FIND_DATAW data;
+    HANDLE hFind;
+    wchar_t filter[MAX_PATH];
+    char name[MAX_PATH * 3];
+    cache_entry_t *entries = NULL;
+    cache_entry_t *files = NULL;
+    cache_entry_t *e = NULL;
+    uint32_t size = 0;
+    uint32_t files_size = 0;
+    uint32_t files_count = 0;
+    int ret = SUCC;
+    int len;
+    int dir;
+
+    // one pass, no short names, bigger batches from the file system
+    len = MultiByteToWideChar(CP_ACP, 0, path, -1, filter, MAX_PATH - 1);
+    if (!len)
+    {
+        log_error("{%s:%d} convert [%s] failed. GetLastError=%d", __FUNCTION__, __LINE__, path, GetLastError());
+        return FAIL;
+    }
+    filter[len - 1] = L'*';
+    filter[len] = 0;
+    hFind = FindFirstFileExW(filter, FindExInfoBasic, &data, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (hFind == INVALID_HANDLE_VALUE)
+    {
+        log_error("{%s:%d} Invalid File Handle. GetLastError=%d", __FUNCTION__, __LINE__, GetLastError());
+        return FAIL;
+    }
+    do
+    {
+        len = WideCharToMultiByte(CP_UTF8, 0, data.cFileName, -1, name, sizeof(name), NULL, NULL);
+        if (len <= 1)
+            continue;
+        dir = !!(FILE_ATTRIBUTE_DIRECTORY & data.dwFileAttributes);
+        // upload state and blobs are not content
+        if (dir && (0 == strcmp(name, UPLOAD_SESSION_DIR) || 0 == strcmp(name, UPLOAD_BLOB_DIR)))
+            continue;
+
+        // directories and files are collected apart, the listing shows directories first
+        if (dir && n->c.count == size)
+        {
+            size = size ? size * 2 : 64;
+            e = (cache_entry_t*)realloc(entries, size * sizeof(cache_entry_t));
+            if (!e)
+            {
+                ret = FAIL;
+                break;
+            }
+            entries = e;
+        }
+        else if (!dir && files_count == files_size)
+        {
+            files_size = files_size ? files_size * 2 : 64;
+            e = (cache_entry_t*)realloc(files, files_size * sizeof(cache_entry_t));
+            if (!e)
+            {
+                ret = FAIL;
+                break;
+            }
+            files = e;
+        }
+        e = dir ? entries + n->c.count++ : files + files_count++;
+        e->name = arena_strdup(&n->c.names, name, len - 1);
+        e->name_len = (uint16_t)(len - 1);
+        e->dir = (uint8_t)dir;
+        e->size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+        e->mtime = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+        if (!e->name)
+        {
+            ret = FAIL;
+            break;
+        }
+    } while (FindNextFileW(hFind, &data));
+    FindClose(hFind);
+
+    // files follow the directories
+    if (ret == SUCC && files_count)
+    {
+        e = (cache_entry_t*)realloc(entries, (n->c.count + files_count) * sizeof(cache_entry_t));
+        if (e)
+        {
+            memcpy(e + n->c.count, files, files_count * sizeof(cache_entry_t));
+            entries = e;
+            n->c.count += files_count;
+        }
+        else
+        {
+            ret = FAIL;
+        }
+    }
+    n->c.entries = entries;
+    free(files);
+    if (ret != SUCC)
+    {
+        log_error("{%s:%d} out of memory listing [%s]", __FUNCTION__, __LINE__, path);
+        return FAIL;
+    }
+    cache_account(n, n->c.count * sizeof(cache_entry_t) + n->c.names.size);
+    return SUCC;
+}
+
+static int compare_name(const void *e1, const void *e2)
+{
+    const cache_entry_t *a = *(const cache_entry_t **)e1;
+    const cache_entry_t *b = *(const cache_entry_t **)e2;
+
+    if (a->dir != b->dir)
+        return b->dir - a->dir;
+    return _stricmp(a->name, b->name);
+}
+
+static int compare_size(const void *e1, const void *e2)
+{
+    const cache_entry_t *a = *(const cache_entry_t **)e1;
+    const cache_entry_t *b = *(const cache_entry_t **)e2;
+
+    if (a->dir != b->dir || a->size == b->size)
+        return compare_name(e1, e2);
+    return a->size < b->size ? -1 : 1;
+}
+
+static int compare_mtime(const void *e1, const void *e2)
+{
+    const cache_entry_t *a = *(const cache_entry_t **)e1;
+    const cache_entry_t *b = *(const cache_entry_t **)e2;
+
+    if (a->dir != b->dir || a->mtime == b->mtime)
+        return compare_name(e1, e2);
+    return a->mtime < b->mtime ? -1 : 1;
+}
+
+static void release_cache_node(struct cache_node_t *n)
+{
+    uint32_t i;
+
+    if (n->c.handle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(n->c.handle);
+    }
+    arena_free(&n->c.names);
+    for (i = 0; i < CACHE_SORT_MAX; i++)
+    {
+        free(n->c.sorted[i]);
+    }
+    free(n->c.entries);
+    free(n->c.content);
+    free(n->c.header);
+    free(n->c.digest);
+    _cache_bytes -= n->bytes;
+    free(n);
+}
+
+static void cache_invalidate(struct cache_node_t *n)
+{
+    RB_REMOVE(cache_tree_t, &_cache_tree, n);
+    if (n->c.refs)
+    {
+        // still being sent, the last cache_close() frees it
+        n->stale = 1;
+        return;
+    }
+    lru_remove(n);
+    release_cache_node(n);
+}
+
+static int cache_validate(struct cache_node_t *n)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+
+    // cached content is dropped by the watcher, no filesystem call on a hit
+    if ((n->c.content || n->c.dir) && _watch_alive)
+        return 1;
+
+    // there is no inode on a path stat, a replaced file gets a new creation time
+    if (!GetFileAttributesExA(n->c.path, GetFileExInfoStandard, &attr))
+        return 0;
+    if (n->c.dir)
+    {
+        // an added or removed entry updates the directory write time
+        return 0 == memcmp(&attr.ftLastWriteTime, &n->c.mtime, sizeof(FILETIME));
+    }
+    return (((uint64_t)attr.nFileSizeHigh << 32) | attr.nFileSizeLow) == n->c.size
+        && 0 == memcmp(&attr.ftCreationTime, &n->c.ctime, sizeof(FILETIME))
+        && 0 == memcmp(&attr.ftLastWriteTime, &n->c.mtime, sizeof(FILETIME));
+}
+
+static void cache_account(struct cache_node_t *n, uint32_t bytes)
+{
+    n->bytes += bytes;
+    _cache_bytes += bytes;
+}
+
+static void cache_trim()
+{
+    while (_cache_tail && (_cache_idle > CACHE_MAX_FILES || _cache_bytes > CACHE_CONTENT_BUDGET))
+    {
+        cache_invalidate(_cache_tail);
+    }
+}
+
+static void cache_sync()
+{
+    struct cache_node_t  k;
+    struct cache_node_t *n = NULL;
+    struct cache_node_t *next = NULL;
+    uint32_t i;
+    size_t len;
+    char *p;
+    char c;
+
+    if (!_watch_dirty)
+        return;
+
+    EnterCriticalSection(&_watch_lock);
+    InterlockedExchange(&_watch_dirty, 0);
+    if (_watch_overflow)
+    {
+        // notifications were lost, forget everything
+        for (n = RB_MIN(cache_tree_t, &_cache_tree); n; n = next)
+        {
+            next = RB_NEXT(cache_tree_t, &_cache_tree, n);
+            cache_invalidate(n);
+        }
+    }
+    else
+    {
+        for (i = 0; i < _watch_size; i++)
+        {
+            memcpy(k.c.path, _watch_paths[i], MAX_PATH);
+            n = RB_FIND(cache_tree_t, &_cache_tree, &k);
+            if (n)
+            {
+                cache_invalidate(n);
+            }
+            if (_watch_quiet[i])
+            {
+                // the listing keeps the size it had, it is refreshed when the file is renamed or removed
+                continue;
+            }
+
+            // listing of the parent directory
+            p = strrchr(k.c.path, '/');
+            if (p)
+            {
+                c = *(p + 1);
+                *(p + 1) = 0;
+                n = RB_FIND(cache_tree_t, &_cache_tree, &k);
+                if (n)
+                {
+                    cache_invalidate(n);
+                }
+                *(p + 1) = c;
+            }
+
+            // a renamed or removed directory takes its files along, they sort right after "<dir>/".
+            // a modified directory only had its entries change, they report on their own
+            len = strlen(k.c.path);
+            if (len + 1 >= MAX_PATH
+                || (_watch_actions[i] != FILE_ACTION_REMOVED && _watch_actions[i] != FILE_ACTION_RENAMED_OLD_NAME))
+                continue;
+            k.c.path[len] = '/';
+            k.c.path[len + 1] = 0;
+            for (n = cache_nfind(&k); n && 0 == _strnicmp(n->c.path, k.c.path, len + 1); n = next)
+            {
+                next = RB_NEXT(cache_tree_t, &_cache_tree, n);
+                cache_invalidate(n);
+            }
+        }
+    }
+    _watch_size = 0;
+    _watch_overflow = 0;
+    LeaveCriticalSection(&_watch_lock);
+}
+
+static DWORD WINAPI watch_proc(LPVOID param)
+{
+    DWORD buffer[BUFFER_UNIT];  // DWORD aligned for FILE_NOTIFY_INFORMATION
+    DWORD bytes = 0;
+    FILE_NOTIFY_INFORMATION *info = NULL;
+    char *path = NULL;
+    int root_len = strlen(root_path());
+    int len, i;
+    uint8_t quiet;
+
+    while (ReadDirectoryChangesW(_watch_dir, buffer, sizeof(buffer), TRUE, WATCH_FILTER, &bytes, NULL, NULL))
+    {
+        EnterCriticalSection(&_watch_lock);
+        if (bytes == 0)
+        {
+            _watch_overflow = 1;
+        }
+        for (info = (FILE_NOTIFY_INFORMATION*)buffer; bytes; info = (FILE_NOTIFY_INFORMATION*)((char*)info + info->NextEntryOffset))
+        {
+            if (_watch_size >= CACHE_WATCH_QUEUE)
+            {
+                _watch_overflow = 1;
+                break;
+            }
+            path = _watch_paths[_watch_size];
+            memcpy(path, root_path(), root_len);
+            len = WideCharToMultiByte(CP_ACP, 0, info->FileName, info->FileNameLength / sizeof(wchar_t),
+                path + root_len, MAX_PATH - root_len - 1, NULL, NULL);
+            if (len > 0)
+            {
+                path[root_len + len] = 0;
+                for (i = root_len; i < root_len + len; i++)
+                {
+                    if (path[i] == '\\')
+                        path[i] = '/';
+                }
+                // a file being written reports every flush, one entry is enough
+                quiet = info->Action == FILE_ACTION_MODIFIED && watch_quiet(path);
+                for (i = 0; quiet && i < (int)_watch_size; i++)
+                {
+                    if (_watch_quiet[i] && 0 == strcmp(_watch_paths[i], path))
+                        break;
+                }
+                if (!quiet || i == (int)_watch_size)
+                {
+                    _watch_quiet[_watch_size] = quiet;
+                    _watch_actions[_watch_size] = (uint8_t)info->Action;
+                    _watch_size++;
+                }
+            }
+            if (!info->NextEntryOffset)
+                break;
+        }
+        LeaveCriticalSection(&_watch_lock);
+        InterlockedExchange(&_watch_dirty, 1);
+    }
+
+    // no more notifications, fall back to a stat on every hit
+    EnterCriticalSection(&_watch_lock);
+    _watch_overflow = 1;
+    InterlockedExchange(&_watch_alive, 0);
+    LeaveCriticalSection(&_watch_lock);
+    InterlockedExchange(&_watch_dirty, 1);
+    return 0;
+}
+
+static int watch_quiet(const char *path)
+{
+    size_t len = strlen(path);
+
+    // uploads in flight, see upload.h and http.c, and the log of the day
+    return (len > strlen(".part") && 0 == _stricmp(path + len - strlen(".part"), ".part"))
+        || log_is_file(path);
+}
+
+static void lru_push(struct cache_node_t *n)
+{
+    n->prev = NULL;
+    n->next = _cache_head;
+    if (_cache_head)
+        _cache_head->prev = n;
+    _cache_head = n;
+    if (!_cache_tail)
+        _cache_tail = n;
+    _cache_idle++;
+}
+
+static void lru_remove(struct cache_node_t *n)
+{
+    if (n->prev)
+        n->prev->next = n->next;
+    else
+        _cache_head = n->next;
+    if (n->next)
+        n->next->prev = n->prev;
+    else
+        _cache_tail = n->prev;
+    n->prev = NULL;
+    n->next = NULL;
+    _cache_idle--;
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#define CACHE_MAX_FILES         256                 // idle files and directories kept
+#define CACHE_CONTENT_MAX       (64 * 1024)         // files up to this size are kept in memory
+#define CACHE_CONTENT_BUDGET    (64 * 1024 * 1024)  // bytes of content, headers and listings in memory
+#define CACHE_WATCH_QUEUE       256                 // pending change notifications
+
+typedef enum
+{
+    CACHE_SORT_NAME         = 0,    // case-insensitive
+    CACHE_SORT_SIZE,
+    CACHE_SORT_MTIME,
+    CACHE_SORT_MAX
+} cache_sort_t;
+
+typedef struct
+{
+    char                   *name;       // utf-8, in the names arena of the listing
+    uint64_t                size;
+    uint64_t                mtime;      // FILETIME of the last write
+    uint16_t                name_len;
+    uint8_t                 dir;
+} cache_entry_t;
+
+typedef struct
+{
+    char                    path[MAX_PATH];
+    HANDLE                  handle;     // shared by every transfer of this file
+    uint64_t                size;       // file size, rendered length for a directory
+    FILETIME                ctime;      // creation time, identifies the file behind the path
+    FILETIME                mtime;      // last write time
+    uint32_t                refs;       // transfers using this handle
+    const char             *mime;       // content type of a file
+    char                   *content;    // whole file for small files, handle is closed then
+    char                   *header;     // pre-rendered response header for content
+    uint32_t                header_size;
+    char                   *digest;     // "sha-256=..., xxh3=..." stored by an upload, NULL if none
+    uint8_t                 dir;        // directory listing, path ends with '/'
+    cache_entry_t          *entries;    // directories first, then files
+    uint32_t                count;
+    arena_t                 names;
+    cache_entry_t         **sorted[CACHE_SORT_MAX];  // directories first, built on first use
+    uint32_t                sorted_count;   // entries without "." and ".."
+} cache_t;
+
+ret_code_t cache_init();
+ret_code_t cache_uninit();
+cache_t   *cache_open(const char *path);
+cache_t   *cache_open_dir(const char *path);
+void       cache_close(cache_t *c);
+ret_code_t cache_read(cache_t *c, uint64_t offset, char *buf, uint32_t size);
+ret_code_t cache_set_header(cache_t *c, const char *header);
+void       cache_set_content(cache_t *c, char *content, uint32_t size);
+cache_entry_t **cache_sorted(cache_t *c, cache_sort_t sort);
+
+#endif
\ No newline at end of file
@@ -5,14 +5,17 @@
 struct rbnode_t {
     RB_ENTRY(rbnode_t) node;
     event_t           *ev;
+    int              (*ready)(event_t *ev);    // paused read, resumed when ready() returns non-zero
+    uint8_t            wake;                    // run the callback on resume, the socket may have nothing to read
 };
 RB_HEAD(rbtree_t, rbnode_t) _read_evs, _write_evs, _except_evs;
 
 fd_set           _readfds                   = { 0 };
 fd_set           _writefds                  = { 0 };
 fd_set           _exceptfds                 = { 0 };
-struct rbnode_t *_active_ns[FD_SETSIZE * 3] = { 0 };
+struct rbnode_t *_active_ns[FD_SETSIZE * 4] = { 0 };  // woken reads come first
 uint32_t         _active_size               = 0;
+uint32_t         _paused_size               = 0;
 
 static int  compare(struct rbnode_t *n1, struct rbnode_t *n2);
 RB_PROTOTYPE(rbtree_t, rbnode_t, node, compare);
@@ -23,6 +26,8 @@ static void release_rbnode(struct rbnode_t *n);
 static void release_rbtree(struct rbtree_t *t);
 static int  event_del_by_fd(uint32_t fd, struct rbtree_t *t, fd_set *s);
 static int  rbnode_del_no_free(struct rbnode_t *n);
+static ret_code_t event_suspend(event_t *ev, int (*ready)(event_t *ev), uint8_t wake);
+static void event_resume_ready();
 
 ret_code_t event_init()
 {
@@ -32,8 +37,9 @@ ret_code_t event_init()
     FD_ZERO(&_readfds);
     FD_ZERO(&_writefds);
     FD_ZERO(&_exceptfds);
-    memset(_active_ns, 0, sizeof(struct rbnode_t*) * FD_SETSIZE * 3);
+    memset(_active_ns, 0, sizeof(_active_ns));
     _active_size = 0;
+    _paused_size = 0;
     return SUCC;
 }
 
@@ -45,8 +51,9 @@ ret_code_t event_uninit()
     FD_ZERO(&_readfds);
     FD_ZERO(&_writefds);
     FD_ZERO(&_exceptfds);
-    memset(_active_ns, 0, sizeof(struct rbnode_t*) * FD_SETSIZE * 3);
+    memset(_active_ns, 0, sizeof(_active_ns));
     _active_size = 0;
+    _paused_size = 0;
     return SUCC;
 }
 
@@ -108,6 +115,36 @@ ret_code_t event_del(event_t *ev)
     return SUCC;
 }
 
+ret_code_t event_pause(event_t *ev, int (*ready)(event_t *ev))
+{
+    return event_suspend(ev, ready, 0);
+}
+
+ret_code_t event_wait(event_t *ev, int (*ready)(event_t *ev))
+{
+    return event_suspend(ev, ready, 1);
+}
+
+static ret_code_t event_suspend(event_t *ev, int (*ready)(event_t *ev), uint8_t wake)
+{
+    struct rbnode_t *n = NULL;
+
+    n = find_rbnode(ev->fd, &_read_evs);
+    if (!n)
+    {
+        log_warn("{%s:%d} event is not exist, fd=%d", __FUNCTION__, __LINE__, ev->fd);
+        return NEXI;
+    }
+    if (!n->ready)
+    {
+        FD_CLR(ev->fd, &_readfds);
+        _paused_size++;
+    }
+    n->ready = ready;
+    n->wake = wake;
+    return SUCC;
+}
+
 ret_code_t event_dispatch()
 {
     fd_set readfds;
@@ -120,6 +157,11 @@ ret_code_t event_dispatch()
     while (TRUE)
     {
         _active_size = 0;
+        if (_paused_size)
+            event_resume_ready();
+        // poll paused events often, select cannot wait for them. woken ones run right away
+        timeout.tv_sec = 0;
+        timeout.tv_usec = _active_size ? 0 : _paused_size ? 10000 : 500000;
         memcpy(&readfds, &_readfds, sizeof(_readfds.fd_count) + _readfds.fd_count * sizeof(SOCKET));
         memcpy(&writefds, &_writefds, sizeof(_writefds.fd_count) + _writefds.fd_count * sizeof(SOCKET));
         memcpy(&exceptfds, &_exceptfds, sizeof(_exceptfds.fd_count) + _exceptfds.fd_count * sizeof(SOCKET));
@@ -253,6 +295,8 @@ static int event_del_by_fd(uint32_t fd, struct rbtree_t *t, fd_set *s)
     n = RB_FIND(rbtree_t, t, &k);
     if (n)
     {
+        if (n->ready)
+            _paused_size--;
         RB_REMOVE(rbtree_t, t, n);
         FD_CLR(fd, s);
         release_rbnode(n);
@@ -294,3 +338,24 @@ static int rbnode_del_no_free(struct rbnode_t *n)
     FD_CLR(n->ev->fd, s);
     return SUCC;
 }
+
+
+static void event_resume_ready()
+{
+    struct rbnode_t *n = NULL;
+
+    RB_FOREACH(n, rbtree_t, &_read_evs)
+    {
+        if (n->ready && n->ready(n->ev))
+        {
+            n->ready = NULL;
+            FD_SET(n->ev->fd, &_readfds);
+            _paused_size--;
+            if (n->wake)
+            {
+                n->wake = 0;
+                _active_ns[_active_size++] = n;
+            }
+        }
+    }
+}
\ No newline at end of file
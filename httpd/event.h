@@ -1,7 +1,6 @@
 #ifndef __EVENT_H__
 #define __EVENT_H__
 
-#define BOUNDARY_MAX_LEN    64
 typedef enum
 {
     EV_UNKNOWN              = 0x00,
@@ -20,12 +19,24 @@ typedef enum
 
 typedef struct
 {
-    char                    file[MAX_PATH];
-    char                    boundary[BOUNDARY_MAX_LEN];
-    uint32_t                total;
-    uint32_t                offset;
-    uint32_t                size;
-    FILE                   *fp;         // fixed fopen EACCES error. just for write file
+    char                   *file;       // MAX_PATH bytes, target or temp file. just for upload
+    boundary_t             *boundary;   // compiled multipart boundary. just for upload
+    char                   *buf;        // receive buffer, grows for fast clients. just for upload
+    uint32_t                cap;
+    char                   *rename_to;  // target of a PUT, file is the temp file until completed
+    uint64_t                chunk;      // bytes left in the current chunk
+    uint8_t                 chunked;    // chunked body parser state, 0 without chunked framing
+    uint8_t                 mode;       // upload_mode_t of the sink
+    uint8_t                 closing;    // close_state_t, the sink is closed by the writer thread
+    uint64_t                first;      // first byte of a Content-Range put
+    uint64_t                total;
+    uint64_t                offset;
+    uint32_t                size;       // bytes in data, or carried over in buf
+    upload_t               *sink;       // coalesced file writer. just for write file
+    uint8_t                *expect;     // sha-256 sent by the client, checked when the file is closed
+    char                   *digests;    // response fields of the files received so far
+    cache_t                *fc;         // cached file handle. just for send file
+    archive_t              *archive;    // directory streamed as tar or zip. just for archive
     char                    data[1];
 } event_data_t;
 
@@ -45,6 +56,8 @@ ret_code_t event_init();
 ret_code_t event_uninit();
 ret_code_t event_add(event_t *ev);
 ret_code_t event_del(event_t *ev);
+ret_code_t event_pause(event_t *ev, int (*ready)(event_t *ev));
+ret_code_t event_wait(event_t *ev, int (*ready)(event_t *ev));    // like pause, then the callback runs once ready
 ret_code_t event_dispatch();
 
 #endif
\ No newline at end of file
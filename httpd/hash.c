@@ -0,0 +1,518 @@
+#include "httpd.h"
+
+
+#define ROTR32(x, n)        (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTL64(x, n)        (((x) << (n)) | ((x) >> (64 - (n))))
+
+#define PRIME32_1           0x9E3779B1U
+#define PRIME32_2           0x85EBCA77U
+#define PRIME32_3           0xC2B2AE3DU
+#define PRIME64_1           0x9E3779B185EBCA87ULL
+#define PRIME64_2           0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3           0x165667B19E3779F9ULL
+#define PRIME64_4           0x85EBCA77C2B2AE63ULL
+#define PRIME64_5           0x27D4EB2F165667C5ULL
+#define PRIME_MX1           0x165667919E3779F9ULL
+#define PRIME_MX2           0x9FB21C651E98DF25ULL
+
+#define XXH3_STRIPE_LEN     64
+#define XXH3_SECRET_SIZE    192
+#define XXH3_BLOCK_STRIPES  ((XXH3_SECRET_SIZE - XXH3_STRIPE_LEN) / 8)
+#define XXH3_SECRET_LIMIT   (XXH3_SECRET_SIZE - XXH3_STRIPE_LEN)
+#define XXH3_MIDSIZE_MAX    240
+
+static const uint32_t _sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+// default secret of xxh3
+static const uint8_t _xxh3_secret[XXH3_SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e
+};
+
+static void     sha256_block(sha256_t *c, const uint8_t *p);
+static uint32_t read32(const uint8_t *p);
+static uint64_t read64(const uint8_t *p);
+static uint64_t mul128_fold64(uint64_t a, uint64_t b);
+static uint64_t xxh64_avalanche(uint64_t h);
+static uint64_t xxh3_avalanche(uint64_t h);
+static uint64_t xxh3_rrmxmx(uint64_t h, uint64_t len);
+static uint64_t xxh3_mix16(const uint8_t *p, const uint8_t *secret);
+static uint64_t xxh3_short(const uint8_t *p, uint32_t len);
+static void     xxh3_accumulate(uint64_t *acc, const uint8_t *p, const uint8_t *secret);
+static void     xxh3_scramble(uint64_t *acc, const uint8_t *secret);
+static void     xxh3_consume(uint64_t *acc, uint32_t *stripes, const uint8_t *p, uint32_t count);
+
+void sha256_init(sha256_t *c)
+{
+    c->state[0] = 0x6a09e667;
+    c->state[1] = 0xbb67ae85;
+    c->state[2] = 0x3c6ef372;
+    c->state[3] = 0xa54ff53a;
+    c->state[4] = 0x510e527f;
+    c->state[5] = 0x9b05688c;
+    c->state[6] = 0x1f83d9ab;
+    c->state[7] = 0x5be0cd19;
+    c->length = 0;
+    c->used = 0;
+}
+
+void sha256_update(sha256_t *c, const void *data, uint32_t size)
+{
+    const uint8_t *p = (const uint8_t*)data;
+    uint32_t len;
+
+    c->length += size;
+    if (c->used)
+    {
+        len = 64 - c->used < size ? 64 - c->used : size;
+        memcpy(c->buf + c->used, p, len);
+        c->used += len;
+        p += len;
+        size -= len;
+        if (c->used < 64)
+            return;
+        sha256_block(c, c->buf);
+        c->used = 0;
+    }
+    for (; size >= 64; p += 64, size -= 64)
+    {
+        sha256_block(c, p);
+    }
+    memcpy(c->buf, p, size);
+    c->used = size;
+}
+
+void sha256_final(sha256_t *c, uint8_t *digest)
+{
+    uint64_t bits = c->length * 8;
+    int i;
+
+    c->buf[c->used++] = 0x80;
+    if (c->used > 56)
+    {
+        memset(c->buf + c->used, 0, 64 - c->used);
+        sha256_block(c, c->buf);
+        c->used = 0;
+    }
+    memset(c->buf + c->used, 0, 56 - c->used);
+    for (i=0; i<8; i++)
+    {
+        c->buf[63 - i] = (uint8_t)(bits >> (i * 8));
+    }
+    sha256_block(c, c->buf);
+    for (i=0; i<32; i++)
+    {
+        digest[i] = (uint8_t)(c->state[i / 4] >> (24 - (i % 4) * 8));
+    }
+}
+
+void xxh3_init(xxh3_t *c)
+{
+    c->acc[0] = PRIME32_3;
+    c->acc[1] = PRIME64_1;
+    c->acc[2] = PRIME64_2;
+    c->acc[3] = PRIME64_3;
+    c->acc[4] = PRIME64_4;
+    c->acc[5] = PRIME32_2;
+    c->acc[6] = PRIME64_5;
+    c->acc[7] = PRIME32_1;
+    c->used = 0;
+    c->stripes = 0;
+    c->length = 0;
+}
+
+void xxh3_update(xxh3_t *c, const void *data, uint32_t size)
+{
+    const uint8_t *p = (const uint8_t*)data;
+    const uint8_t *end = p + size;
+    uint32_t len;
+
+    c->length += size;
+    if (c->used + size <= sizeof(c->buf))
+    {
+        memcpy(c->buf + c->used, p, size);
+        c->used += size;
+        return;
+    }
+    if (c->used)
+    {
+        len = sizeof(c->buf) - c->used;
+        memcpy(c->buf + c->used, p, len);
+        p += len;
+        xxh3_consume(c->acc, &c->stripes, c->buf, sizeof(c->buf) / XXH3_STRIPE_LEN);
+        c->used = 0;
+    }
+    // at least one byte stays buffered for the last stripe
+    if (end - p > (int)sizeof(c->buf))
+    {
+        do
+        {
+            xxh3_consume(c->acc, &c->stripes, p, sizeof(c->buf) / XXH3_STRIPE_LEN);
+            p += sizeof(c->buf);
+        } while (end - p > (int)sizeof(c->buf));
+        memcpy(c->buf + sizeof(c->buf) - XXH3_STRIPE_LEN, p - XXH3_STRIPE_LEN, XXH3_STRIPE_LEN);
+    }
+    c->used = end - p;
+    memcpy(c->buf, p, c->used);
+}
+
+uint64_t xxh3_final(const xxh3_t *c)
+{
+    uint64_t acc[8];
+    uint8_t last[XXH3_STRIPE_LEN];
+    const uint8_t *stripe = NULL;
+    uint32_t stripes = c->stripes;
+    uint64_t result;
+    uint32_t catchup;
+    int i;
+
+    if (c->length <= XXH3_MIDSIZE_MAX)
+        return xxh3_short(c->buf, (uint32_t)c->length);
+
+    memcpy(acc, c->acc, sizeof(acc));
+    if (c->used >= XXH3_STRIPE_LEN)
+    {
+        xxh3_consume(acc, &stripes, c->buf, (c->used - 1) / XXH3_STRIPE_LEN);
+        stripe = c->buf + c->used - XXH3_STRIPE_LEN;
+    }
+    else
+    {
+        // the last stripe starts in bytes that were already consumed
+        catchup = XXH3_STRIPE_LEN - c->used;
+        memcpy(last, c->buf + sizeof(c->buf) - catchup, catchup);
+        memcpy(last + catchup, c->buf, c->used);
+        stripe = last;
+    }
+    xxh3_accumulate(acc, stripe, _xxh3_secret + XXH3_SECRET_LIMIT - 7);
+
+    result = c->length * PRIME64_1;
+    for (i=0; i<4; i++)
+    {
+        result += mul128_fold64(acc[2 * i] ^ read64(_xxh3_secret + 11 + 16 * i),
+            acc[2 * i + 1] ^ read64(_xxh3_secret + 11 + 16 * i + 8));
+    }
+    return xxh3_avalanche(result);
+}
+
+void hash_init(hash_t *h)
+{
+    sha256_init(&h->sha256);
+    xxh3_init(&h->xxh3);
+}
+
+void hash_update(hash_t *h, const void *data, uint32_t size)
+{
+    sha256_update(&h->sha256, data, size);
+    xxh3_update(&h->xxh3, data, size);
+}
+
+void hash_final(hash_t *h, hash_digest_t *digest)
+{
+    digest->size = h->sha256.length;
+    sha256_final(&h->sha256, digest->sha256);
+    digest->xxh3 = xxh3_final(&h->xxh3);
+}
+
+int hash_format(const hash_digest_t *digest, char *buf)
+{
+    char *p = buf;
+    int i;
+
+    memcpy(p, "sha-256=", 8);
+    p += 8;
+    p += base64_encode(digest->sha256, SHA256_SIZE, p);
+    memcpy(p, ", xxh3=", 7);
+    p += 7;
+    for (i=60; i>=0; i-=4)
+    {
+        *p++ = "0123456789abcdef"[(digest->xxh3 >> i) & 0xF];
+    }
+    *p = 0;
+    return p - buf;
+}
+
+int hash_parse_sha256(const char *value, uint8_t *sha256)
+{
+    const char *p = NULL;
+
+    // "SHA-256=<base64>" of Digest, "sha-256=:<base64>:" of Repr-Digest, among other algorithms
+    for (p=value; *p; p++)
+    {
+        if ((p == value || p[-1] == ' ' || p[-1] == ',') && 0 == _strnicmp(p, "sha-256=", sizeof("sha-256=") - 1))
+        {
+            p += sizeof("sha-256=") - 1;
+            if (*p == ':')
+                p++;
+            return SHA256_SIZE == base64_decode(p, sha256, SHA256_SIZE);
+        }
+    }
+    return 0;
+}
+
+ret_code_t hash_save(const char *path, const hash_digest_t *digest)
+{
+    char stream[MAX_PATH + sizeof(HASH_STREAM)] = {0};
+    char buf[HASH_DIGEST_LEN + 32] = {0};
+    HANDLE handle;
+    DWORD writen = 0;
+    int len;
+
+    // the stream moves with the file when it is renamed
+    sprintf(stream, "%s" HASH_STREAM, path);
+    len = uint64_to_buf(digest->size, buf);
+    buf[len++] = '\n';
+    len += hash_format(digest, buf + len);
+    handle = CreateFileA(stream, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        log_warn("{%s:%d} create [%s] failed. GetLastError=%d", __FUNCTION__, __LINE__, stream, GetLastError());
+        return FAIL;
+    }
+    if (!WriteFile(handle, buf, len, &writen, NULL) || writen != (DWORD)len)
+    {
+        log_warn("{%s:%d} write [%s] failed. GetLastError=%d", __FUNCTION__, __LINE__, stream, GetLastError());
+        CloseHandle(handle);
+        return FAIL;
+    }
+    CloseHandle(handle);
+    return SUCC;
+}
+
+ret_code_t hash_load(const char *path, uint64_t size, char *buf)
+{
+    char stream[MAX_PATH + sizeof(HASH_STREAM)] = {0};
+    char data[HASH_DIGEST_LEN + 32] = {0};
+    HANDLE handle;
+    DWORD len = 0;
+    char *p = NULL;
+    uint64_t n;
+
+    sprintf(stream, "%s" HASH_STREAM, path);
+    handle = CreateFileA(stream, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+        return NEXI;
+    if (!ReadFile(handle, data, sizeof(data) - 1, &len, NULL))
+        len = 0;
+    CloseHandle(handle);
+    data[len] = 0;
+
+    // "<size>\n<digest>", a file rewritten by something else keeps a stale stream
+    if (!(p = strchr(data, '\n')) || p - data >= HASH_DIGEST_LEN)
+        return FAIL;
+    *p++ = 0;
+    if (SUCC != str_to_uint64(data, &n) || n != size || strlen(p) >= HASH_DIGEST_LEN)
+        return FAIL;
+    memcpy(buf, p, strlen(p) + 1);
+    return SUCC;
+}
+
+static void sha256_block(sha256_t *c, const uint8_t *p)
+{
+    uint32_t w[64];
+    uint32_t a, b, d, e, f, g, h, k, t1, t2;
+    int i;
+
+    for (i=0; i<16; i++)
+    {
+        w[i] = (uint32_t)p[i * 4] << 24 | (uint32_t)p[i * 4 + 1] << 16 | (uint32_t)p[i * 4 + 2] << 8 | p[i * 4 + 3];
+    }
+    for (i=16; i<64; i++)
+    {
+        t1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        t2 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        w[i] = t1 + w[i - 7] + t2 + w[i - 16];
+    }
+    a = c->state[0]; b = c->state[1]; k = c->state[2]; d = c->state[3];
+    e = c->state[4]; f = c->state[5]; g = c->state[6]; h = c->state[7];
+    for (i=0; i<64; i++)
+    {
+        t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) + _sha256_k[i] + w[i];
+        t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & k) ^ (b & k));
+        h = g; g = f; f = e; e = d + t1;
+        d = k; k = b; b = a; a = t1 + t2;
+    }
+    c->state[0] += a; c->state[1] += b; c->state[2] += k; c->state[3] += d;
+    c->state[4] += e; c->state[5] += f; c->state[6] += g; c->state[7] += h;
+}
+
+static uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t mul128_fold64(uint64_t a, uint64_t b)
+{
+    uint64_t lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+    uint64_t hi_lo = (a >> 32) * (b & 0xFFFFFFFF);
+    uint64_t lo_hi = (a & 0xFFFFFFFF) * (b >> 32);
+    uint64_t hi_hi = (a >> 32) * (b >> 32);
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+    uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    uint64_t lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+    return lower ^ upper;
+}
+
+static uint64_t xxh64_avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static uint64_t xxh3_avalanche(uint64_t h)
+{
+    h ^= h >> 37;
+    h *= PRIME_MX1;
+    h ^= h >> 32;
+    return h;
+}
+
+static uint64_t xxh3_rrmxmx(uint64_t h, uint64_t len)
+{
+    h ^= ROTL64(h, 49) ^ ROTL64(h, 24);
+    h *= PRIME_MX2;
+    h ^= (h >> 35) + len;
+    h *= PRIME_MX2;
+    h ^= h >> 28;
+    return h;
+}
+
+static uint64_t xxh3_mix16(const uint8_t *p, const uint8_t *secret)
+{
+    return mul128_fold64(read64(p) ^ read64(secret), read64(p + 8) ^ read64(secret + 8));
+}
+
+static uint64_t xxh3_short(const uint8_t *p, uint32_t len)
+{
+    const uint8_t *s = _xxh3_secret;
+    uint64_t acc, lo, hi;
+    uint32_t combined, i;
+
+    if (len == 0)
+        return xxh64_avalanche(read64(s + 56) ^ read64(s + 64));
+    if (len <= 3)
+    {
+        combined = ((uint32_t)p[0] << 16) | ((uint32_t)p[len >> 1] << 24) | p[len - 1] | (len << 8);
+        return xxh64_avalanche((uint64_t)combined ^ (read32(s) ^ read32(s + 4)));
+    }
+    if (len <= 8)
+    {
+        acc = (read32(p + len - 4) + ((uint64_t)read32(p) << 32)) ^ (read64(s + 8) ^ read64(s + 16));
+        return xxh3_rrmxmx(acc, len);
+    }
+    if (len <= 16)
+    {
+        lo = read64(p) ^ (read64(s + 24) ^ read64(s + 32));
+        hi = read64(p + len - 8) ^ (read64(s + 40) ^ read64(s + 48));
+        acc = len + ((lo >> 56) | ((lo >> 40) & 0xFF00) | ((lo >> 24) & 0xFF0000) | ((lo >> 8) & 0xFF000000)
+            | ((lo << 8) & 0xFF00000000ULL) | ((lo << 24) & 0xFF0000000000ULL) | ((lo << 40) & 0xFF000000000000ULL) | (lo << 56))
+            + hi + mul128_fold64(lo, hi);
+        return xxh3_avalanche(acc);
+    }
+    acc = len * PRIME64_1;
+    if (len <= 128)
+    {
+        if (len > 32)
+        {
+            if (len > 64)
+            {
+                if (len > 96)
+                {
+                    acc += xxh3_mix16(p + 48, s + 96);
+                    acc += xxh3_mix16(p + len - 64, s + 112);
+                }
+                acc += xxh3_mix16(p + 32, s + 64);
+                acc += xxh3_mix16(p + len - 48, s + 80);
+            }
+            acc += xxh3_mix16(p + 16, s + 32);
+            acc += xxh3_mix16(p + len - 32, s + 48);
+        }
+        acc += xxh3_mix16(p, s);
+        acc += xxh3_mix16(p + len - 16, s + 16);
+        return xxh3_avalanche(acc);
+    }
+    for (i=0; i<8; i++)
+    {
+        acc += xxh3_mix16(p + 16 * i, s + 16 * i);
+    }
+    acc = xxh3_avalanche(acc);
+    for (i=8; i<len/16; i++)
+    {
+        acc += xxh3_mix16(p + 16 * i, s + 16 * (i - 8) + 3);
+    }
+    acc += xxh3_mix16(p + len - 16, s + 136 - 17);
+    return xxh3_avalanche(acc);
+}
+
+static void xxh3_accumulate(uint64_t *acc, const uint8_t *p, const uint8_t *secret)
+{
+    uint64_t v, k;
+    int i;
+
+    for (i=0; i<8; i++)
+    {
+        v = read64(p + 8 * i);
+        k = v ^ read64(secret + 8 * i);
+        acc[i ^ 1] += v;
+        acc[i] += (k & 0xFFFFFFFF) * (k >> 32);
+    }
+}
+
+static void xxh3_scramble(uint64_t *acc, const uint8_t *secret)
+{
+    int i;
+
+    for (i=0; i<8; i++)
+    {
+        acc[i] ^= acc[i] >> 47;
+        acc[i] ^= read64(secret + 8 * i);
+        acc[i] *= PRIME32_1;
+    }
+}
+
+static void xxh3_consume(uint64_t *acc, uint32_t *stripes, const uint8_t *p, uint32_t count)
+{
+    uint32_t i;
+
+    // a block is XXH3_BLOCK_STRIPES stripes, each one uses the secret 8 bytes further on
+    for (i=0; i<count; i++, p+=XXH3_STRIPE_LEN)
+    {
+        xxh3_accumulate(acc, p, _xxh3_secret + *stripes * 8);
+        if (++*stripes == XXH3_BLOCK_STRIPES)
+        {
+            xxh3_scramble(acc, _xxh3_secret + XXH3_SECRET_LIMIT);
+            *stripes = 0;
+        }
+    }
+}
\ No newline at end of file
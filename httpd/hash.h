@@ -0,0 +1,55 @@
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#define SHA256_SIZE         32
+#define HASH_DIGEST_LEN     96      // "sha-256=<base64>, xxh3=<hex>"
+#define HASH_STREAM         ":httpd.digest"     // alternate data stream next to the content
+
+typedef struct
+{
+    uint32_t                state[8];
+    uint64_t                length;
+    uint8_t                 buf[64];
+    uint32_t                used;
+} sha256_t;
+
+typedef struct
+{
+    uint64_t                acc[8];
+    uint8_t                 buf[256];   // input is consumed 4 stripes at a time
+    uint32_t                used;
+    uint32_t                stripes;    // stripes consumed in the current block
+    uint64_t                length;
+} xxh3_t;
+
+typedef struct
+{
+    sha256_t                sha256;
+    xxh3_t                  xxh3;
+} hash_t;
+
+typedef struct
+{
+    uint64_t                size;       // bytes hashed
+    uint64_t                xxh3;
+    uint8_t                 sha256[SHA256_SIZE];
+} hash_digest_t;
+
+void sha256_init(sha256_t *c);
+void sha256_update(sha256_t *c, const void *data, uint32_t size);
+void sha256_final(sha256_t *c, uint8_t *digest);
+void xxh3_init(xxh3_t *c);
+void xxh3_update(xxh3_t *c, const void *data, uint32_t size);
+uint64_t xxh3_final(const xxh3_t *c);
+
+void hash_init(hash_t *h);
+void hash_update(hash_t *h, const void *data, uint32_t size);
+void hash_final(hash_t *h, hash_digest_t *digest);
+int  hash_format(const hash_digest_t *digest, char *buf);
+int  hash_parse_sha256(const char *value, uint8_t *sha256);
+
+// digests kept with the file, so downloads do not rehash it
+ret_code_t hash_save(const char *path, const hash_digest_t *digest);
+ret_code_t hash_load(const char *path, uint64_t size, char *buf);
+
+#endif
\ No newline at end of file
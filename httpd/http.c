@@ -1,11 +1,80 @@
 #include "httpd.h"
 #include <errno.h>
+#include <emmintrin.h>
+#include <Mswsock.h>
+
+#pragma comment(lib, "Mswsock.lib")
 
 
 #define LF                  (u_char) '\n'
 #define CR                  (u_char) '\r'
 #define CRLF                "\r\n"
 
+#define HTTP_200            "HTTP/1.1 200 OK" CRLF
+#define HTTP_DATE_SIZE      (sizeof("Date: Sun, 06 Nov 1994 08:49:37 GMT" CRLF CRLF) - 1)
+
+#define UPLOAD_BUFFER_MIN   (16 * 1024)
+#define UPLOAD_BUFFER_MAX   (512 * 1024)
+#define SEND_SLICE          BUFFER_UNIT // archive bytes per writable event, a blocking TransmitFile of it returns at once
+#define ARCHIVE_CHUNK_LINE  16          // room for the chunk size line ahead of the archive bytes
+#define LIST_LIMIT_DEFAULT  1000        // json listing entries per page
+#define LIST_LIMIT_MAX      10000
+#define URI_WIDE_MAX        4096        // characters of a non-ascii uri converted to the ansi code page
+#define CONN_ARENA(ev)      (&((conn_t*)(ev)->param)->arena)
+
+typedef enum
+{
+    CHUNK_NONE              = 0,
+    CHUNK_SIZE,                 // hex size [; extensions] CRLF
+    CHUNK_DATA,
+    CHUNK_DATA_END,             // CRLF after the data
+    CHUNK_TRAILER,              // trailer fields up to an empty line
+    CHUNK_DONE
+} chunk_state_t;
+
+typedef enum
+{
+    CLOSE_NONE              = 0,
+    CLOSE_PART,                 // a multipart file, more parts are buffered behind it
+    CLOSE_LAST                  // the whole body is in, the response follows the close
+} close_state_t;
+
+typedef enum
+{
+    PAGE_201,
+    PAGE_202,
+    PAGE_400,
+    PAGE_404,
+    PAGE_411,
+    PAGE_500,
+    PAGE_501,
+    PAGE_503,
+    PAGE_507,
+    PAGE_UPLOAD_OK,
+    PAGE_UPLOAD_FAIL,
+    PAGE_MAX
+} response_page_t;
+
+typedef struct
+{
+    const char          *title;
+    const char          *status;
+    char                 header[256];   // without Date, rendered by response_init()
+    uint32_t             header_size;
+    char                 body[512];
+    uint32_t             body_size;
+} response_fixed_t;
+
+// state of a client connection, ev->param of all its events.
+// an idle keep-alive connection holds no buffer, only this record and its event
+typedef struct
+{
+    arena_t              arena;     // header, fields and rendered pages of the current request
+    char                *block;     // pooled first block of the arena, NULL while idle
+    uint8_t              reading;   // inside read_callback, release_event leaves the free to it
+    uint8_t              closed;
+} conn_t;
+
 typedef struct  
 {
     char                *key;
@@ -23,42 +92,111 @@ typedef struct
 
 static void accept_callback(event_t *ev);
 static void read_callback(event_t *ev);
+static void read_event(event_t *ev);
 static void write_callback(event_t *ev);
 
 static int   read_request_header(event_t *ev, char **buf, int *size);
 static void  read_request_boundary(event_t *ev);
-static int   parse_request_header(char *data, request_header_t *header);
-static void  release_request_header(request_header_t *header);
+static void  read_request_put(event_t *ev, request_header_t *header, char *path);
+static void  read_request_body(event_t *ev);
+static int   parse_chunked(event_t *ev, char **data, char *end);
+static void  finish_request_put(event_t *ev);
+static void  request_upload_session(event_t *ev, request_header_t *header, char *id);
+static void  finish_request_patch(event_t *ev);
+static ret_code_t upload_sink_close(event_t *ev, const char *field);
+static int   upload_buffer_compact(event_t *ev, char *data, char *end, int full);
+static const char *request_field(request_header_t *header, const char *key);
+static int   upload_ready(event_t *ev);
+static int   upload_closed_ready(event_t *ev);
+static void  close_request_body(event_t *ev);
+static uint64_t upload_expected(event_t *ev, uint64_t rest);
+static int   parse_request_header(arena_t *arena, char *data, request_header_t *header);
 static void  release_event(event_t *ev);
+static void  conn_attach(conn_t *conn);
+static void  conn_detach(conn_t *conn);
 static event_data_t *create_event_data(const char *header, const char *html);
-static event_data_t *create_event_data_fp(const char *header, FILE *fp, int read_len, int total_len);
 static void  release_event_data(event_t *ev);
-static void  uri_decode(char* uri);
-static uint8_t ishex(uint8_t x);
-static char *local_file_list(char *path);
+static int   uri_decode(char *uri, int *ascii);
+static int   query_path_valid(const char *path);
+static int   uri_scan(const char *uri, uint32_t len, int *ascii);
+static int   uri_to_ansi(char *uri);
+static char *local_file_list(arena_t *arena, cache_t *dc);
+static int   json_escape(const char *str, char *buf);
+static int   query_param(const char *query, const char *key, char *value, int size);
 static int   reset_filename_from_formdata(event_t *ev, char **formdata, int size);
-static int   parse_boundary(event_t *ev, char *data, int size, char **ptr);
 
 static const char *reponse_content_type(char *file_name);
-static const char *response_header_format();
 static const char *response_body_format();
+static void response_init();
+static const char *response_date();
+static int  response_header_prefix(char *buf, const char *status, const char *type, uint64_t length, cache_t *fc);
+static int  response_header(char *buf, const char *status, const char *type, uint64_t length, cache_t *fc);
 static void response_home_page(event_t *ev, char *path);
-static void response_upload_page(event_t *ev, int result);
+static void response_upload_page(event_t *ev, ret_code_t result, const char *fields);
 static void response_send_file_page(event_t *ev, char *file_name);
+static void response_dir_query(event_t *ev, char *path, const char *query);
+static void response_json_list(event_t *ev, char *path, const char *query);
+static void response_archive_page(event_t *ev, char *path, const char *format);
+static void send_archive(event_t *ev);
+static void send_file(event_t *ev);
+static void send_again(event_t *ev);
 static void response_http_400_page(event_t *ev);
 static void response_http_404_page(event_t *ev);
 static void response_http_500_page(event_t *ev);
 static void response_http_501_page(event_t *ev);
-static void send_response(event_t *ev, char* title, char *status);
+static void response_upload_offset(event_t *ev, const char *status, uint64_t offset, uint64_t length, const char *id);
+static void send_response(event_t *ev, response_page_t page);
+static void send_response_fields(event_t *ev, response_page_t page, const char *fields);
+static void send_header(event_t *ev, const char *header, const char *body);
+
+// hex digit values, 0xFF for anything else
+static const uint8_t _hex[256] = {
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+       0,   1,   2,   3,   4,   5,   6,   7,   8,   9,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,  10,  11,  12,  13,  14,  15,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,  10,  11,  12,  13,  14,  15,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF
+};
+
+static response_fixed_t _pages[PAGE_MAX] = {
+    { "201 Created",                NULL     },
+    { "202 Accepted",               NULL     },
+    { "400 Bad Request",            NULL     },
+    { "404 Not Found",              NULL     },
+    { "411 Length Required",        NULL     },
+    { "500 Internal Server Error",  NULL     },
+    { "501 Not Implemented",        NULL     },
+    { "503 Service Unavailable",    NULL     },
+    { "507 Insufficient Storage",   NULL     },
+    { "Upload completed",           "200 OK" },
+    { "Upload failed",              "200 OK" }
+};
 
 int http_startup(uint16_t *port)
 {
     SOCKET fd;
     event_t ev = {0};
 
+    log_init();
     log_info("{%s:%d} Http server start...", __FUNCTION__, __LINE__);
     network_init();
     event_init();
+    mime_init(MIME_TYPES_FILE);
+    cache_init();
+    upload_init();
+    iobuf_init();
+    response_init();
     network_listen(port, &fd);
 
     ev.fd = fd;
@@ -70,9 +208,14 @@ int http_startup(uint16_t *port)
     event_dispatch();
 
     closesocket(fd);
+    iobuf_uninit();
+    upload_uninit();
+    cache_uninit();
+    mime_uninit();
     event_uninit();
     network_unint();
     log_info("{%s:%d} Http server stop ...", __FUNCTION__, __LINE__);
+    log_uninit();
     return SUCC;
 }
 
@@ -81,14 +224,31 @@ static void accept_callback(event_t *ev)
     SOCKET fd;
     struct in_addr addr;
     event_t ev_ = {0};
+    conn_t *conn = NULL;
 
     if (SUCC == network_accept(ev->fd, &addr, &fd))
     {   
+        // one small allocation per connection, buffers are attached per request
+        conn = (conn_t*)malloc(sizeof(conn_t));
+        if (!conn)
+        {
+            log_error("{%s:%d} malloc failed", __FUNCTION__, __LINE__);
+            closesocket(fd);
+            return;
+        }
+        memset(conn, 0, sizeof(conn_t));
+        arena_init(&conn->arena, ARENA_BLOCK);
         ev_.fd = fd;
         ev_.ip = addr.s_addr;
         ev_.type = EV_READ | EV_PERSIST;
+        ev_.param = conn;
         ev_.callback = read_callback;
-        event_add(&ev_);
+        if (SUCC != event_add(&ev_))
+        {
+            closesocket(fd);
+            free(conn);
+            return;
+        }
 
         log_info("{%s:%d} A new client connect. ip = %s, socket=%d", __FUNCTION__, __LINE__, inet_ntoa(addr), fd);
     }
@@ -99,35 +259,76 @@ static void accept_callback(event_t *ev)
 }
 
 static void read_callback(event_t *ev)
+{
+    conn_t *conn = (conn_t*)ev->param;
+
+    conn->reading = 1;
+    read_event(ev);
+    conn->reading = 0;
+    if (conn->closed)
+    {
+        // ev is gone with the socket
+        free(conn);
+        return;
+    }
+    if (ev->status == EV_IDLE)
+    {
+        // responses own copies of what they send, the connection waits without buffers
+        conn_detach(conn);
+    }
+}
+
+static void read_event(event_t *ev)
 {
     char *buf = NULL;
     int   size;
     request_header_t header;
     int   i;
-    int   content_length = 0;
+    uint64_t content_length = 0;
     char *temp = NULL;
     char  file_path[MAX_PATH] = {0};
+    int   ascii;
 
     if (ev->status == EV_IDLE)
     {
+        // a new request, the buffer is attached again
+        conn_attach((conn_t*)ev->param);
         if (SUCC != read_request_header(ev, &buf, &size))
         {
             response_http_400_page(ev);
-            free(buf);
             return;
         }
         if (!buf)
             return;
-        parse_request_header(buf, &header);
-        uri_decode(header.uri);
-        header.uri = utf8_to_ansi(header.uri);
+        if (SUCC != parse_request_header(CONN_ARENA(ev), buf, &header))
+        {
+            response_http_500_page(ev);
+            return;
+        }
+        // decoded in place, the ansi code page is only involved for non-ascii names
+        if (SUCC != uri_decode(header.uri, &ascii) || (!ascii && SUCC != uri_to_ansi(header.uri)))
+        {
+            log_warn("{%s:%d} bad uri [%s]. socket=%d", __FUNCTION__, __LINE__, header.uri, ev->fd);
+            response_http_400_page(ev);
+            return;
+        }
         log_info("{%s:%d} >>> Entry recv ... uri=%s", __FUNCTION__, __LINE__, header.uri);
-        if (strcmp(header.method, "GET") && strcmp(header.method, "POST"))
+        if (0 == strncmp(header.uri, "/" UPLOAD_SESSION_DIR "/", strlen("/" UPLOAD_SESSION_DIR "/")))
+        {
+            // resumable uploads
+            request_upload_session(ev, &header, header.uri + strlen("/" UPLOAD_SESSION_DIR "/"));
+            return;
+        }
+        if (upload_reserved(header.uri + 1))
+        {
+            log_warn("{%s:%d} reserved path [%s]. socket=%d", __FUNCTION__, __LINE__, header.uri, ev->fd);
+            response_http_404_page(ev);
+            return;
+        }
+        if (strcmp(header.method, "GET") && strcmp(header.method, "POST") && strcmp(header.method, "PUT"))
         {
             // 501 Not Implemented
             response_http_501_page(ev);
-            release_request_header(&header);
-            free(buf);
             return;
         }
         if (0 == strcmp(header.method, "POST"))
@@ -148,6 +349,15 @@ static void read_callback(event_t *ev)
             memcpy(file_path, root_path(), strlen(root_path()));
             if (strlen(header.uri) > strlen("/upload?path="))
             {
+                // the query is decoded but not folded, it must not leave the root
+                if (0 != strncmp(header.uri, "/upload?path=", strlen("/upload?path="))
+                    || !query_path_valid(header.uri + strlen("/upload?path="))
+                    || strlen(root_path()) + strlen(header.uri) >= MAX_PATH)
+                {
+                    log_warn("{%s:%d} bad upload path [%s]. socket=%d", __FUNCTION__, __LINE__, header.uri, ev->fd);
+                    response_http_400_page(ev);
+                    return;
+                }
                 memcpy(file_path+strlen(file_path), header.uri+strlen("/upload?path="), strlen(header.uri)-strlen("/upload?path="));
             }
             if (0 == strcmp(header.method, "POST"))
@@ -157,7 +367,12 @@ static void read_callback(event_t *ev)
                 {
                     if (0 == strcmp(header.fields[i].key, "Content-Length"))
                     {
-                        content_length = atoi(header.fields[i].value);
+                        if (SUCC != str_to_uint64(header.fields[i].value, &content_length))
+                        {
+                            // 400 Bad Request
+                            response_http_400_page(ev);
+                            return;
+                        }
                         break;
                     }
                 }
@@ -166,20 +381,23 @@ static void read_callback(event_t *ev)
                     // not support
                     // 501 Not Implemented
                     response_http_501_page(ev);
-                    release_request_header(&header);
-                    free(buf);
                     return;
                 }
 
                 // get boundary
-                ev->data = (event_data_t*)malloc(sizeof(event_data_t)-sizeof(char)+BUFFER_UNIT);
-                memset(ev->data, 0, sizeof(event_data_t)-sizeof(char)+BUFFER_UNIT);
-                if (!ev->data)
+                ev->data = (event_data_t*)malloc(sizeof(event_data_t));
+                if (ev->data)
+                {
+                    memset(ev->data, 0, sizeof(event_data_t));
+                    ev->data->buf = (char*)malloc(UPLOAD_BUFFER_MIN);
+                    ev->data->cap = UPLOAD_BUFFER_MIN;
+                    ev->data->file = (char*)malloc(MAX_PATH);
+                }
+                if (!ev->data || !ev->data->buf || !ev->data->file)
                 {
+                    release_event_data(ev);
                     // 500 Internal Server Error
                     response_http_500_page(ev);
-                    release_request_header(&header);
-                    free(buf);
                     return;
                 }
                 for (i=0; i<header.fields_count; i++)
@@ -190,27 +408,23 @@ static void read_callback(event_t *ev)
                         if (temp)
                         {
                             temp += strlen("boundary=");
-                            memcpy(ev->data->boundary, temp, strlen(temp));
+                            ev->data->boundary = boundary_create(temp);
                         }
                         break;
                     }
                 }
-                if (ev->data->boundary[0] == 0)
+                if (!ev->data->boundary)
                 {
                     // not support
                     // 501 Not Implemented
+                    release_event_data(ev);
                     response_http_501_page(ev);
-                    release_request_header(&header);
-                    free(buf);
                     return;
                 }
 
-                // release memory
-                release_request_header(&header);
-                free(buf);
 
                 // set event
-                memcpy(ev->data->file, file_path, strlen(file_path));
+                memcpy(ev->data->file, file_path, strlen(file_path) + 1);
                 ev->data->offset = 0;
                 ev->data->total = content_length;
 
@@ -222,16 +436,25 @@ static void read_callback(event_t *ev)
                 // not support
                 // 501 Not Implemented
                 response_http_501_page(ev);
-                free(buf);
-                release_request_header(&header);
                 return;
             }
         }
+        else if (0 == strcmp(header.method, "PUT"))
+        {
+            // raw body straight to the file, no multipart framing
+            read_request_put(ev, &header, header.uri+1);
+            return;
+        }
+        else if ((temp = strstr(header.uri, "/?")))
+        {
+            // directory with a query: archive download or json listing
+            temp[1] = 0;
+            response_dir_query(ev, header.uri+1, temp+2);
+            return;
+        }
         else if (header.uri[strlen(header.uri)-1] == '/')
         {
             response_home_page(ev, header.uri+1);
-            free(buf);
-            release_request_header(&header);
             return;
         }
         else
@@ -241,40 +464,63 @@ static void read_callback(event_t *ev)
             memcpy(file_path, root_path(), strlen(root_path()));
             memcpy(file_path+strlen(file_path), header.uri+1, strlen(header.uri+1));
             response_send_file_page(ev, file_path);
-            free(buf);
-            release_request_header(&header);
             return;
         }
     }
-    else
+    else if (ev->data->boundary)
     {
         // read & save files
         read_request_boundary(ev);
     }
+    else
+    {
+        // read & save put or patch body
+        read_request_body(ev);
+    }
 }
 
 static void write_callback(event_t *ev)
 {
+    WSABUF bufs[3];
+
     if (!ev->data)
         return;
 
-    if (ev->data->size != send(ev->fd, ev->data->data, ev->data->size, 0))
+    if (ev->data->archive)
     {
-        log_error("{%s:%d} send fail. socket=%d, WSAGetLastError=%d", __FUNCTION__, __LINE__, ev->fd, WSAGetLastError());
-        shutdown(ev->fd, SD_SEND);
-        release_event_data(ev);
+        send_archive(ev);
         return;
     }
-    log_debug("{%s:%d} send response completed. progress=%d%%, socket=%d", __FUNCTION__, __LINE__, ev->data->total ? ev->data->offset*100/ev->data->total : 100, ev->fd);
-    if (ev->data->total == ev->data->offset)
+    if (ev->data->fc && !ev->data->fc->content)
     {
-        log_info("{%s:%d} send response completed. socket=%d", __FUNCTION__, __LINE__, ev->fd);
-        release_event_data(ev);
+        send_file(ev);
+        return;
     }
-    else
+    if (ev->data->fc)
+    {
+        // cached content: header, Date and body in one gather send
+        bufs[0].buf = ev->data->fc->header;
+        bufs[0].len = ev->data->fc->header_size;
+        bufs[1].buf = (char*)response_date();
+        bufs[1].len = HTTP_DATE_SIZE;
+        bufs[2].buf = ev->data->fc->content;
+        bufs[2].len = (uint32_t)ev->data->fc->size;
+        if (SUCC != network_writev(ev->fd, bufs, 3))
+        {
+            shutdown(ev->fd, SD_SEND);
+            release_event_data(ev);
+            return;
+        }
+    }
+    else if (ev->data->size != send(ev->fd, ev->data->data, ev->data->size, 0))
     {
-        response_send_file_page(ev, ev->data->file);
+        log_error("{%s:%d} send fail. socket=%d, WSAGetLastError=%d", __FUNCTION__, __LINE__, ev->fd, WSAGetLastError());
+        shutdown(ev->fd, SD_SEND);
+        release_event_data(ev);
+        return;
     }
+    log_info("{%s:%d} send response completed. socket=%d", __FUNCTION__, __LINE__, ev->fd);
+    release_event_data(ev);
 }
 
 static int read_request_header(event_t *ev, char **buf, int *size)
@@ -290,6 +536,7 @@ static int read_request_header(event_t *ev, char **buf, int *size)
         if (ret == DISC)
         {
             release_event(ev);
+            *buf = NULL;
             return SUCC;
         }
         else if (ret == SUCC)
@@ -297,24 +544,18 @@ static int read_request_header(event_t *ev, char **buf, int *size)
             if (*buf == NULL)
             {
                 *size = BUFFER_UNIT;
-                *buf = (char*)malloc(*size);
+                *buf = (char*)arena_alloc(CONN_ARENA(ev), *size);
                 if (!(*buf))
-                {
-                    log_error("{%s:%d} malloc fail.", __FUNCTION__, __LINE__);
                     return FAIL;
-                }
             }
             (*buf)[idx++] = c;
             if (idx >= *size - 1) // last char using for '\0'
             {
-                // buffer is not enough
+                // buffer is not enough, extended in place while the arena block has room
+                *buf = (char*)arena_grow(CONN_ARENA(ev), *buf, *size, *size + BUFFER_UNIT);
                 *size += BUFFER_UNIT;
-                *buf = (char*)realloc(*buf, *size);
                 if (!(*buf))
-                {
-                    log_error("{%s:%d} realloc fail.", __FUNCTION__, __LINE__);
                     return FAIL;
-                }
             }
             if (idx >= 4 && (*buf)[idx - 1] == LF && (*buf)[idx - 2] == CR
                 && (*buf)[idx - 3] == LF && (*buf)[idx - 4] == CR)
@@ -336,13 +577,14 @@ static int read_request_header(event_t *ev, char **buf, int *size)
 
 static void read_request_boundary(event_t *ev)
 {
-#define WRITE_FILE(fp, buf, size, ev) do { \
+#define WRITE_FILE(sink, buf, size, ev) do { \
     if (size) { \
-        if (size != fwrite(compare_buff, 1, size, fp)) { \
+        ret = sink ? upload_write(sink, buf, size) : FAIL; \
+        if (ret != SUCC) { \
         log_error("{%s:%d} write file fail. socket=%d", __FUNCTION__, __LINE__, ev->fd); \
             release_event_data(ev); \
             ev->status = EV_IDLE; \
-            response_upload_page(ev, 0); \
+            response_upload_page(ev, ret, NULL); \
             return; \
         } \
     } \
@@ -354,39 +596,74 @@ static void read_request_boundary(event_t *ev)
         log_error("{%s:%d} cannot found filename in formdata. socket=%d", __FUNCTION__, __LINE__, ev->fd); \
         release_event_data(ev); \
         ev->status = EV_IDLE; \
-        response_upload_page(ev, 0); \
+        response_upload_page(ev, FAIL, NULL); \
         return; \
     } else if (ret == 1) { \
-        ev->data->fp = fopen(ev->data->file, "wb"); \
-        if (!ev->data->fp) { \
-            log_error("{%s:%d} open file fail. filename=%s, socket=%d, errno=%d", __FUNCTION__, __LINE__, ev->data->file, ev->fd, errno); \
+        ret = upload_open(upload_blob_exists(ev->data->expect) ? NULL : ev->data->file, UPLOAD_CREATE, 0, upload_expected(ev, (end - ptr) + (ev->data->total - ev->data->offset - len)), &ev->data->sink); \
+        if (ret != SUCC) { \
+            log_error("{%s:%d} open file fail. filename=%s, socket=%d", __FUNCTION__, __LINE__, ev->data->file, ev->fd); \
             release_event_data(ev); \
             ev->status = EV_IDLE; \
-            response_upload_page(ev, 0); \
+            response_upload_page(ev, ret, NULL); \
             return; \
         } \
-        compare_buff_size -= ptr - compare_buff; \
-        memcpy(compare_buff, ptr, compare_buff_size); \
-        compare_buff[compare_buff_size] = 0; \
+        data = ptr; \
         goto _re_find; \
     } else { \
-        ev->data->size = compare_buff + compare_buff_size - ptr; \
-        memcpy(ev->data->data, ptr, ev->data->size); \
+        data = mark; /* part header is incomplete, parse it again with the next read */ \
     } \
 } while (0)
 
-    char    *buf    = NULL;
+    char    *data   = NULL;
+    char    *end    = NULL;
+    char    *mark   = NULL;
     char    *ptr    = NULL;
+    char    *fields = NULL;
+    char     field[MAX_PATH + 32];
     int      ret    = 0;
-    uint32_t offset = 0;
+    uint32_t room   = 0;
+    uint32_t len    = 0;
     uint32_t writen = 0;
-    uint32_t compare_buff_size = 0;
-    char     buffer[BUFFER_UNIT+1] = {0};
-    char     compare_buff[BUFFER_UNIT*2 + 1] = {0};
+    int      full   = 0;
+
+    if (ev->data->closing)
+    {
+        // the writer thread has closed the file, woken by upload_closed_ready()
+        sprintf(field, "Upload-Digest: \"%s\", ", strrchr(ev->data->rename_to, '/') + 1);
+        ret = upload_sink_close(ev, field);
+        if (ev->data->closing == CLOSE_LAST)
+        {
+            log_info("{%s:%d} upload [%s] %s. socket=%d", __FUNCTION__, __LINE__, ev->data->file, ret == SUCC ? "complete" : "failed", ev->fd);
+            fields = ev->data->digests;
+            ev->data->digests = NULL;
+            release_event_data(ev);
+            ev->status = EV_IDLE;
+            response_upload_page(ev, ret, fields);
+            free(fields);
+            return;
+        }
+        ev->data->closing = CLOSE_NONE;
+        if (ret != SUCC)
+        {
+            log_error("{%s:%d} upload [%s] failed. socket=%d", __FUNCTION__, __LINE__, ev->data->file, ev->fd);
+            release_event_data(ev);
+            ev->status = EV_IDLE;
+            response_upload_page(ev, ret, NULL);
+            return;
+        }
+        log_info("{%s:%d} upload [%s] complete. socket=%d", __FUNCTION__, __LINE__, ev->data->file, ev->fd);
+        // the next part is parsed from the buffer, the socket may have nothing to read
+        ret = SUCC;
+    }
+    else
+    {
+        // append to the bytes carried over from the previous read
+        room = ev->data->cap - ev->data->size;
+        if (room > ev->data->total - ev->data->offset)
+            room = (uint32_t)(ev->data->total - ev->data->offset);
+        ret = network_read_some(ev->fd, ev->data->buf + ev->data->size, room, &len);
+    }
 
-    offset = ev->data->total - ev->data->offset > BUFFER_UNIT ? BUFFER_UNIT : ev->data->total - ev->data->offset;
-    ret = network_read(ev->fd, buffer, offset);
-    
     if (ret == DISC)
     {
         response_http_500_page(ev);
@@ -395,75 +672,110 @@ static void read_request_boundary(event_t *ev)
     }
     else if (ret == SUCC)
     {
-        memset(compare_buff, 0, sizeof(compare_buff));
-        if (ev->data->size)
-        {
-            memcpy(compare_buff, ev->data->data, ev->data->size);
-        }
-        memcpy(compare_buff+ev->data->size, buffer, offset);
-        compare_buff_size = offset + ev->data->size;
-        ev->data->size = 0;
-        memset(ev->data->data, 0, BUFFER_UNIT);
+        full = len && len == ev->data->cap - ev->data->size;
+        data = ev->data->buf;
+        end = ev->data->buf + ev->data->size + len;
 
-        // parse boundary
+        // parse boundary in place
     _re_find:
-        ret = parse_boundary(ev, compare_buff, compare_buff_size, &ptr);
+        mark = data;
+        ret = boundary_search(ev->data->boundary, data, end - data, &ptr);
         switch (ret)
         {
-        case 0: // write all bytes to file
-            WRITE_FILE(ev->data->fp, compare_buff, compare_buff_size, ev);
-            log_debug("{%s:%d} upload [%s] progress=%d%%. socket=%d", __FUNCTION__, __LINE__, ev->data->file, ev->data->offset * 100 / ev->data->total, ev->fd);
+        case BOUNDARY_NONE: // write all bytes to file
+            WRITE_FILE(ev->data->sink, data, (uint32_t)(end - data), ev);
+            data = end;
+            // one line per percent, not per chunk
+            if (LOG_ENABLED(LOG_DEBU) && ev->data->offset * 100 / ev->data->total != (ev->data->offset + len) * 100 / ev->data->total)
+                log_debug("{%s:%d} upload [%s] progress=%d%%. socket=%d", __FUNCTION__, __LINE__, ev->data->file, (int)((ev->data->offset + len) * 100 / ev->data->total), ev->fd);
             break;
-        case 1: // first boundary
+        case BOUNDARY_FIRST:
             // get file name from boundary header
-            GET_FILENAME(ev, ptr, compare_buff + compare_buff_size - ptr);
+            GET_FILENAME(ev, ptr, end - ptr);
             break;
-        case 2: // last boundary
-            ASSERT(ev->data->total == ev->data->offset + offset);
-            writen = ptr - compare_buff;
+        case BOUNDARY_LAST:
+            ASSERT(ev->data->total == ev->data->offset + len);
+            writen = ptr - data;
             // writen bytes before boundary
-            WRITE_FILE(ev->data->fp, compare_buff, writen, ev);
-            fclose(ev->data->fp);
-            log_info("{%s:%d} upload [%s] complete. socket=%d", __FUNCTION__, __LINE__, ev->data->file, ev->fd);
+            WRITE_FILE(ev->data->sink, data, writen, ev);
+            if (ev->data->sink)
+            {
+                // answered once the file is on disk
+                upload_close(ev->data->sink);
+                ev->data->closing = CLOSE_LAST;
+                ev->data->offset += len;
+                ev->status = EV_BUSY;
+                event_wait(ev, upload_closed_ready);
+                return;
+            }
+            // no file part was open
+            log_info("{%s:%d} upload [%s] failed. socket=%d", __FUNCTION__, __LINE__, ev->data->file, ev->fd);
+            fields = ev->data->digests;
+            ev->data->digests = NULL;
             release_event_data(ev);
             ev->status = EV_IDLE;
-            response_upload_page(ev, 1);
+            response_upload_page(ev, FAIL, fields);
+            free(fields);
             return;
-        case 3: // middle boundary
+        case BOUNDARY_MIDDLE:
             // writen bytes before boundary
-            writen = ptr - compare_buff;
-            WRITE_FILE(ev->data->fp, compare_buff, writen, ev);
-            fclose(ev->data->fp);
-            log_info("{%s:%d} upload [%s] complete. socket=%d", __FUNCTION__, __LINE__, ev->data->file, ev->fd);
+            writen = ptr - data;
+            WRITE_FILE(ev->data->sink, data, writen, ev);
+            if (ev->data->sink)
+            {
+                // the delimiter is kept, it is found again once the file is closed
+                upload_close(ev->data->sink);
+                ev->data->closing = CLOSE_PART;
+                data = ptr;
+                break;
+            }
             // get file name from boundary header
-            GET_FILENAME(ev, ptr, compare_buff + compare_buff_size - ptr);
+            mark = ptr;
+            GET_FILENAME(ev, ptr, end - ptr);
             break;
-        case 4: // backup last boundary
-        case 5: // backup middle boundary
-            writen = ptr - compare_buff;
-            WRITE_FILE(ev->data->fp, compare_buff, writen, ev);
-            // backup
-            ev->data->size = compare_buff + compare_buff_size - ptr;
-            memcpy(ev->data->data, ptr, ev->data->size);
+        case BOUNDARY_PARTIAL:
+            // only the bytes that may start a delimiter are carried over
+            writen = ptr - data;
+            WRITE_FILE(ev->data->sink, data, writen, ev);
+            data = ptr;
             break;
         default:
             break;
         }
 
-        ev->data->offset += offset;
+        if (!upload_buffer_compact(ev, data, end, full))
+        {
+            log_error("{%s:%d} part header too large. socket=%d", __FUNCTION__, __LINE__, ev->fd);
+            release_event_data(ev);
+            ev->status = EV_IDLE;
+            response_upload_page(ev, FAIL, NULL);
+            return;
+        }
+
+        ev->data->offset += len;
         ev->status = EV_BUSY;
+
+        if (ev->data->closing)
+        {
+            event_wait(ev, upload_closed_ready);
+        }
+        // the disk is behind, stop reading the socket until the writer catches up
+        else if (ev->data->sink && upload_busy(ev->data->sink))
+        {
+            event_pause(ev, upload_ready);
+        }
     }
     else
     {
         log_error("{%s:%d} recv unknown fail.", __FUNCTION__, __LINE__);
         release_event_data(ev);
         ev->status = EV_IDLE;
-        response_upload_page(ev, 0);
+        response_upload_page(ev, FAIL, NULL);
         return;
     }
 }
 
-static int parse_request_header(char *data, request_header_t *header)
+static int parse_request_header(arena_t *arena, char *data, request_header_t *header)
 {
 #define move_next_line(x)   while (*x && *(x + 1) && *x != CR && *(x + 1) != LF) x++;
 #define next_header_line(x) while (*x && *(x + 1) && *x != CR && *(x + 1) != LF) x++; *x=0;
@@ -501,12 +813,9 @@ static int parse_request_header(char *data, request_header_t *header)
             break;
     }
     // malloc fields
-    header->fields = (request_fields_t*)malloc(sizeof(request_fields_t)*header->fields_count);
+    header->fields = (request_fields_t*)arena_alloc(arena, sizeof(request_fields_t)*header->fields_count);
     if (!header->fields)
-    {
-        log_error("{%s:%d} malloc fail.", __FUNCTION__, __LINE__);
         return FAIL;
-    }
     // set fields
     data = p = q;
     while (*p)
@@ -530,23 +839,37 @@ static int parse_request_header(char *data, request_header_t *header)
     return SUCC;
 }
 
-static void release_request_header(request_header_t *header)
+static void release_event(event_t *ev)
 {
-    if (header->uri)
-    {
-        free(header->uri);
-    }
-    if (header->fields)
+    conn_t *conn = (conn_t*)ev->param;
+
+    closesocket(ev->fd);
+    release_event_data(ev);
+    event_del(ev);
+    if (conn)
     {
-        free(header->fields);
+        conn_detach(conn);
+        if (conn->reading)
+            conn->closed = 1;
+        else
+            free(conn);
     }
 }
 
-static void release_event(event_t *ev)
+static void conn_attach(conn_t *conn)
 {
-    closesocket(ev->fd);
-    release_event_data(ev);
-    event_del(ev);
+    // without a pooled buffer the arena takes its blocks from the heap
+    if (!conn->block && (conn->block = iobuf_get()))
+        arena_init_inline(&conn->arena, conn->block, IOBUF_SIZE, ARENA_BLOCK);
+    arena_reset(&conn->arena);
+}
+
+static void conn_detach(conn_t *conn)
+{
+    arena_free(&conn->arena);
+    arena_init(&conn->arena, ARENA_BLOCK);
+    iobuf_put(conn->block);
+    conn->block = NULL;
 }
 
 static event_data_t *create_event_data(const char *header, const char *html)
@@ -579,394 +902,962 @@ static event_data_t *create_event_data(const char *header, const char *html)
     return ev_data;
 }
 
-static event_data_t *create_event_data_fp(const char *header, FILE *fp, int read_len, int total_len)
-{
-    event_data_t* ev_data = NULL;
-    int header_length = 0;
-    int data_length = 0;
-
-    if (header)
-        header_length = strlen(header);
-
-    data_length = sizeof(event_data_t) - sizeof(char) + header_length + read_len;
-    ev_data = (event_data_t*)malloc(data_length);
-    if (!ev_data)
-    {
-        log_error("{%s:%d} malloc failed", __FUNCTION__, __LINE__);
-        return ev_data;
-    }
-    memset(ev_data, 0, data_length);
-    ev_data->total = total_len;
-    ev_data->size = read_len + header_length;
-    if (header)
-        memcpy(ev_data->data, header, header_length);
-    if (read_len != fread(ev_data->data + header_length, 1, read_len, fp))
-    {
-        log_error("{%s:%d} fread failed", __FUNCTION__, __LINE__);
-        free(ev_data);
-        ev_data = NULL;
-    }
-    return ev_data;
-}
-
 static void release_event_data(event_t *ev)
 {
+    int done;
+
     if (ev->data)
     {
-        if (ev->data->fp)
+        if (ev->data->sink)
+        {
+            // a session keeps what arrived, the client resumes from there.
+            // the writer thread closes the file, nothing waits for it
+            if (ev->data->mode == UPLOAD_APPEND)
+                upload_detach(ev->data->sink);
+            else
+                upload_abort(ev->data->sink);
+            ev->data->sink = NULL;
+        }
+        if (ev->data->rename_to)
         {
-            fclose(ev->data->fp);
-            ev->data->fp = NULL;
+            // unfinished put, drop the temp file. a missing range is sent again
+            if (ev->data->mode == UPLOAD_SHARED)
+                upload_range_end(ev->data->rename_to, 0, 0, &done);
+            else
+                DeleteFileA(ev->data->file);
+            free(ev->data->rename_to);
+            ev->data->rename_to = NULL;
+        }
+        if (ev->data->fc)
+        {
+            cache_close(ev->data->fc);
+            ev->data->fc = NULL;
         }
+        archive_close(ev->data->archive);
+        boundary_free(ev->data->boundary);
+        free(ev->data->buf);
+        free(ev->data->file);
+        free(ev->data->expect);
+        free(ev->data->digests);
         free(ev->data);
         ev->data = NULL;
     }
 }
 
-static void uri_decode(char* uri)
+static int uri_decode(char *uri, int *ascii)
 {
-    int len = strlen(uri);
-    char *out = NULL;
-    char *o = out;
+    uint32_t len = strlen(uri);
+    char *end = uri + len;
     char *s = uri;
-    char *end = uri + strlen(uri);
+    char *o = uri;
+    char *seg = uri + 1;    // output of the current path segment
+    char *p = NULL;
+    int query = 0;
+    int sep;
     int c;
 
-    out = (char*)malloc(len+1);
-    if (!out)
-    {
-        log_error("{%s:%d} malloc fail.", __FUNCTION__, __LINE__);
-        return;
-    }
+    if (*uri != '/')
+        return PARA;
+    if (!uri_scan(uri, len, ascii))
+        return SUCC;
 
-    for (o = out; s <= end; o++)
+    // one pass: escapes are decoded, "//", "." and ".." are folded, o never passes s
+    *ascii = 1;
+    s++;
+    o++;
+    while (s <= end)
     {
-        c = *s++;
-        if (c == '+')
+        c = (uint8_t)*s++;
+        sep = !query && (c == '/' || c == '\\' || c == '?' || c == 0);
+        if (c == '%')
+        {
+            if (s + 2 > end || _hex[(uint8_t)s[0]] > 15 || _hex[(uint8_t)s[1]] > 15)
+                return PARA;
+            c = _hex[(uint8_t)s[0]] << 4 | _hex[(uint8_t)s[1]];
+            s += 2;
+            if (!c)
+                return PARA;
+            if (!query)
+                sep = c == '/' || c == '\\';
+        }
+        else if (c == '+' && query)
         {
+            // a form value, '+' is a plain character in the path
             c = ' ';
         }
-        else if (c == '%' 
-            && (!ishex(*s++) || !ishex(*s++) || !sscanf(s - 2, "%2x", &c)))
+        if (c & 0x80)
+            *ascii = 0;
+        if (!sep)
         {
-            // bad uri
-            free(out);
-            return;
+            // a drive or stream name never reaches the file system
+            if (c == ':' && !query)
+                return PARA;
+            *o++ = (char)c;
+            if (!c)
+                break;
+            continue;
         }
 
-        if (out)
+        // windows drops trailing dots and spaces, "..." or ".. " would climb like ".."
+        for (p = seg; p < o && (*p == '.' || *p == ' '); p++);
+        if (p == o && o != seg && !(o - seg <= 2 && 0 == memcmp(seg, "..", o - seg)))
+            return PARA;
+        if (o - seg == 1 && seg[0] == '.')
+        {
+            o = seg;
+        }
+        else if (o - seg == 2 && seg[0] == '.' && seg[1] == '.')
+        {
+            // up one level, never above the root
+            if (seg == uri + 1)
+                return PARA;
+            o = seg - 1;
+            while (o[-1] != '/')
+                o--;
+            seg = o;
+        }
+        else if (o != seg && c != '?' && c != 0)
+        {
+            *o++ = '/';
+            seg = o;
+        }
+        if (c == '?')
+        {
+            *o++ = '?';
+            query = 1;
+        }
+        else if (c == 0)
         {
-            *o = c;
+            *o = 0;
+            break;
         }
     }
-
-    memcpy(uri, out, strlen(out));
-    uri[strlen(out)] = 0;
-    free(out);
+    return SUCC;
 }
 
-static uint8_t ishex(uint8_t x)
+static int query_path_valid(const char *path)
 {
-    return	(x >= '0' && x <= '9')	||
-        (x >= 'a' && x <= 'f')	||
-        (x >= 'A' && x <= 'F');
+    const char *seg = path;
+    const char *p = NULL;
+    const char *q = NULL;
+
+    // relative with '/' only, no segment that windows resolves to "." or "..",
+    // and nothing of the upload state
+    if (*path == '/' || upload_reserved(path))
+        return 0;
+    for (p = path; ; p++)
+    {
+        if (*p == '\\' || *p == ':' || (*p && (uint8_t)*p < 0x20))
+            return 0;
+        if (*p && *p != '/')
+            continue;
+        // trailing dots and spaces are dropped by windows, "..." climbs as well
+        for (q = p; q > seg && (q[-1] == '.' || q[-1] == ' '); q--);
+        if (q == seg && (p != seg || *p))
+            return 0;
+        if (!*p)
+            return 1;
+        seg = p + 1;
+    }
 }
 
-static int reset_filename_from_formdata(event_t *ev, char **formdata, int size)
+static int uri_scan(const char *uri, uint32_t len, int *ascii)
 {
-    char *file_name = NULL;
-    char *p         = NULL;
-    int   i         = 0;
-    int   found     = 0;
-    char *anis      = NULL;
+    const __m128i percent = _mm_set1_epi8('%');
+    const __m128i plus = _mm_set1_epi8('+');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i dot = _mm_set1_epi8('.');
+    const __m128i space = _mm_set1_epi8(' ');
+    __m128i v0, v1, m;
+    uint32_t high = 0;
+    uint32_t i = 0;
+    int c;
 
-    // find "\r\n\r\n"
-    p = *formdata;
-    for (int i = 0; i <= size-4; i++)
+    // 16 bytes at a time: anything to decode or fold, and bytes above 0x7F
+    for (; i + 17 <= len; i += 16)
     {
-        if (0 == memcmp(*formdata + i, CRLF CRLF, strlen(CRLF CRLF)))
-        {
-            found = 1;
-            (*formdata)[i] = 0;
-            (*formdata) += i + strlen(CRLF CRLF);
-            break;
-        }
+        v0 = _mm_loadu_si128((const __m128i*)(uri + i));
+        v1 = _mm_loadu_si128((const __m128i*)(uri + i + 1));
+        m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v0, percent), _mm_cmpeq_epi8(v0, plus)),
+            _mm_or_si128(_mm_cmpeq_epi8(v0, backslash), _mm_cmpeq_epi8(v0, colon)));
+        m = _mm_or_si128(m, _mm_and_si128(_mm_cmpeq_epi8(v0, slash),
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v1, slash), _mm_cmpeq_epi8(v1, dot)), _mm_cmpeq_epi8(v1, space))));
+        if (_mm_movemask_epi8(m))
+            return 1;
+        high |= _mm_movemask_epi8(v0);
     }
-    if (!found)
-        return 2;
+    for (; i < len; i++)
+    {
+        c = (uint8_t)uri[i];
+        if (c == '%' || c == '+' || c == '\\' || c == ':' || (c == '/' && (uri[i + 1] == '/' || uri[i + 1] == '.' || uri[i + 1] == ' ')))
+            return 1;
+        high |= c & 0x80;
+    }
+    *ascii = !high;
+    return 0;
+}
 
-    // file upload file name from formdata
-    file_name = strstr(p, "filename=\"");
-    if (!file_name)
-        return 0;
-    file_name += strlen("filename=\"");
-    *strstr(file_name, "\"") = 0;
+static int uri_to_ansi(char *uri)
+{
+    wchar_t wide[URI_WIDE_MAX];
+    int len;
 
-    anis = utf8_to_ansi(file_name);
+    // never longer in the ansi code page than in utf-8, converted back into place
+    len = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, uri, -1, wide, URI_WIDE_MAX);
+    if (!len || !WideCharToMultiByte(CP_ACP, 0, wide, -1, uri, strlen(uri) + 1, NULL, NULL))
+        return PARA;
+    return SUCC;
+}
 
-    // IE browser: remove client file path
-    p = anis;
-    while (*p)
+static void read_request_put(event_t *ev, request_header_t *header, char *path)
+{
+    const char *value = NULL;
+    char temp[MAX_PATH] = {0};
+    uint64_t content_length = 0;
+    uint64_t first = 0;
+    uint64_t last = 0;
+    uint64_t total = 0;
+    uint8_t chunked = CHUNK_NONE;
+    uint8_t mode = UPLOAD_CREATE;
+    ret_code_t ret;
+
+    if (!*path || path[strlen(path)-1] == '/'
+        || strlen(root_path()) + strlen(path) + sizeof(".4294967295.part") > MAX_PATH)
     {
-        if (*p == '\\' || *p == '/')
-        if (*(p + 1))
-            anis = p + 1;
-        p++;
+        response_http_400_page(ev);
+        return;
     }
-
-    // reset filepath
-    for (i = strlen(ev->data->file) - 1; i >= 0; i--)
+    if ((value = request_field(header, "Transfer-Encoding")) && strstr(value, "chunked"))
     {
-        if (ev->data->file[i] == '/')
+        chunked = CHUNK_SIZE;
+    }
+    else if (!(value = request_field(header, "Content-Length")))
+    {
+        // 411 Length Required
+        send_response(ev, PAGE_411);
+        return;
+    }
+    else if (SUCC != str_to_uint64(value, &content_length))
+    {
+        response_http_400_page(ev);
+        return;
+    }
+    if ((value = request_field(header, "Content-Range")))
+    {
+        // bytes first-last/total, several connections fill one file
+        if (chunked || 3 != sscanf(value, "bytes %llu-%llu/%llu", &first, &last, &total)
+            || first > last || last >= total || last - first + 1 != content_length)
         {
-            memcpy(ev->data->file + i + 1, anis, strlen(anis) + 1);
-            break;
+            response_http_400_page(ev);
+            return;
         }
+        mode = UPLOAD_SHARED;
     }
 
-    // if file exist delete file
-    if (file_exist(ev->data->file))
+    ev->data = (event_data_t*)malloc(sizeof(event_data_t));
+    if (ev->data)
     {
-        remove_file(ev->data->file);
+        memset(ev->data, 0, sizeof(event_data_t));
+        ev->data->buf = (char*)malloc(UPLOAD_BUFFER_MIN);
+        ev->data->cap = UPLOAD_BUFFER_MIN;
+        ev->data->rename_to = (char*)malloc(MAX_PATH);
+        ev->data->file = (char*)malloc(MAX_PATH);
     }
-    free(anis);
-    return 1;
-}
-
-static int parse_boundary(event_t *ev, char *data, int size, char **ptr)
-{
-    char first_boundary[BOUNDARY_MAX_LEN]  = { 0 };
-    char middle_boundary[BOUNDARY_MAX_LEN] = { 0 };
-    char last_boundary[BOUNDARY_MAX_LEN]   = { 0 };
-    int  first_len, middle_len, last_len;
-    int i;
-
-    sprintf(first_boundary, "--%s\r\n", ev->data->boundary);      //------WebKitFormBoundaryOG3Viw9MEZcexbvT\r\n
-    sprintf(middle_boundary, "\r\n--%s\r\n", ev->data->boundary);   //\r\n------WebKitFormBoundaryOG3Viw9MEZcexbvT\r\n
-    sprintf(last_boundary, "\r\n--%s--\r\n", ev->data->boundary); //\r\n------WebKitFormBoundaryOG3Viw9MEZcexbvT--\r\n
-    first_len  = strlen(first_boundary);
-    middle_len = strlen(middle_boundary);
-    last_len   = strlen(last_boundary);
-
-    ASSERT(size > first_len);
-    ASSERT(size > middle_len);
-    ASSERT(size > last_len);
-    if (0 == memcmp(data, first_boundary, first_len))
+    if (!ev->data || !ev->data->buf || !ev->data->rename_to || !ev->data->file)
     {
-        *ptr = data + first_len;
-        return 1; // first boundary
+        release_event_data(ev);
+        response_http_500_page(ev);
+        return;
     }
-
-    for (i = 0; i < size; i++)
+    sprintf(ev->data->rename_to, "%s%s", root_path(), path);
+    if (mode == UPLOAD_SHARED)
     {
-        if (size - i >= last_len)
+        // every range goes to one part file, the last one in renames it
+        ret = upload_range_begin(ev->data->rename_to, total, temp);
+        if (ret != SUCC)
         {
-            if (0 == memcmp(data + i, middle_boundary, middle_len))
-            {
-                *ptr = data + i/* + middle_len*/;
-                return 3; // middle boundary
-            }
-
-            if (0 == memcmp(data + i, last_boundary, last_len))
-            {
-                *ptr = data + (size - last_len);
-                return 2; // last boundary
-            }
+            free(ev->data->rename_to);
+            ev->data->rename_to = NULL;
+            release_event_data(ev);
+            send_response(ev, ret == PARA ? PAGE_400 : PAGE_500);
+            return;
         }
-        else if (size - i >= middle_len && size - i < last_len)
+    }
+    else
+    {
+        // written next to the target, renamed over it once the body is complete
+        sprintf(temp, "%s.%u.part", ev->data->rename_to, ev->fd);
+        total = content_length;
+    }
+    memcpy(ev->data->file, temp, strlen(temp) + 1);
+    ev->data->mode = mode;
+    if (mode == UPLOAD_CREATE && ((value = request_field(header, "Repr-Digest")) || (value = request_field(header, "Digest"))))
+    {
+        // checked against the hash of the received bytes, Content-MD5 is not supported.
+        // content already in the blob store is only hashed, not written again
+        ev->data->expect = (uint8_t*)malloc(SHA256_SIZE);
+        if (ev->data->expect && !hash_parse_sha256(value, ev->data->expect))
         {
-            if (0 == memcmp(data + i, middle_boundary, middle_len))
-            {
-                *ptr = data + i/* + middle_len*/;
-                return 3; // middle boundary
-            }
-            if (0 == memcmp(data + i, last_boundary, size - i))
-            {
-                *ptr = data + i;
-                return 4; // backup last boundary
-            }
+            free(ev->data->expect);
+            ev->data->expect = NULL;
         }
-        else if (size - i >= 7 && size - i < middle_len)
+    }
+    ret = upload_open(upload_blob_exists(ev->data->expect) ? NULL : temp, mode, first, total, &ev->data->sink);
+    if (ret != SUCC)
+    {
+        release_event_data(ev);
+        send_response(ev, ret == FULL ? PAGE_507 : PAGE_500);
+        return;
+    }
+    ev->data->first = first;
+    ev->data->total = content_length;
+    ev->data->offset = 0;
+    ev->data->chunked = chunked;
+    ev->status = EV_BUSY;
+
+    // curl -T waits for this before sending a large body
+    if ((value = request_field(header, "Expect")) && 0 == _stricmp(value, "100-continue"))
+    {
+        network_write(ev->fd, "HTTP/1.1 100 Continue" CRLF CRLF, sizeof("HTTP/1.1 100 Continue" CRLF CRLF) - 1);
+    }
+    if (!chunked && !content_length)
+    {
+        close_request_body(ev);
+    }
+}
+
+static void read_request_body(event_t *ev)
+{
+    char    *data = NULL;
+    char    *end  = NULL;
+    uint32_t room = 0;
+    uint32_t len  = 0;
+    int      full = 0;
+    int      ret;
+
+    if (ev->data->closing)
+    {
+        // the writer thread has closed the file, woken by upload_closed_ready()
+        if (ev->data->mode == UPLOAD_APPEND)
+            finish_request_patch(ev);
+        else
+            finish_request_put(ev);
+        return;
+    }
+    room = ev->data->cap - ev->data->size;
+    if (!ev->data->chunked && room > ev->data->total - ev->data->offset)
+        room = (uint32_t)(ev->data->total - ev->data->offset);
+    if (SUCC != network_read_some(ev->fd, ev->data->buf + ev->data->size, room, &len))
+    {
+        // the temp file is removed with the event data
+        release_event(ev);
+        return;
+    }
+    full = len == ev->data->cap - ev->data->size;
+    data = ev->data->buf;
+    end = ev->data->buf + ev->data->size + len;
+    ev->data->offset += len;
+
+    if (ev->data->chunked)
+    {
+        ret = parse_chunked(ev, &data, end);
+    }
+    else
+    {
+        ret = upload_write(ev->data->sink, data, end - data);
+        data = end;
+    }
+    if (ret != SUCC || !upload_buffer_compact(ev, data, end, full))
+    {
+        log_error("{%s:%d} upload [%s] failed. socket=%d", __FUNCTION__, __LINE__, ev->data->file, ev->fd);
+        release_event_data(ev);
+        ev->status = EV_IDLE;
+        send_response(ev, ret == FULL ? PAGE_507 : (ret == SUCC || ret == PARA ? PAGE_400 : PAGE_500));
+        return;
+    }
+
+    if (ev->data->chunked ? ev->data->chunked == CHUNK_DONE : ev->data->offset == ev->data->total)
+    {
+        close_request_body(ev);
+    }
+    else if (upload_busy(ev->data->sink))
+    {
+        event_pause(ev, upload_ready);
+    }
+}
+
+static int parse_chunked(event_t *ev, char **data, char *end)
+{
+    char *p = *data;
+    char *line = NULL;
+    uint64_t n;
+    uint32_t len;
+    int digit;
+    int ret;
+
+    while (p < end && ev->data->chunked != CHUNK_DONE)
+    {
+        switch (ev->data->chunked)
         {
-            if (0 == memcmp(data + i, middle_boundary, size - i))
+        case CHUNK_SIZE:
+        case CHUNK_TRAILER:
+            line = (char*)memchr(p, LF, end - p);
+            if (!line)
             {
-                *ptr = data + i;
-                return 5; // backup middle boundary
+                // wait for the rest of the line
+                *data = p;
+                return SUCC;
             }
-            if (0 == memcmp(data + i, last_boundary, size - i))
+            if (ev->data->chunked == CHUNK_TRAILER)
             {
-                *ptr = data + i;
-                return 4; // backup last boundary
+                if (line == p || (line == p + 1 && *p == CR))
+                    ev->data->chunked = CHUNK_DONE;
+                p = line + 1;
+                break;
             }
-        }
-        else
-        {
-            if (0 == memcmp(data + i, middle_boundary, size - i))
+            for (n = 0; p < line; p++)
             {
-                *ptr = data + i;
-                return 5; // backup middle boundary
+                if (*p >= '0' && *p <= '9')
+                    digit = *p - '0';
+                else if ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'f')
+                    digit = (*p | 0x20) - 'a' + 10;
+                else
+                    break;
+                if (n >> 60)
+                    return PARA;    // overflow
+                n = (n << 4) | digit;
             }
-            if (0 == memcmp(data + i, last_boundary, size - i))
+            if (p == *data || (p < line && *p != ';' && *p != ' ' && *p != CR))
+                return PARA;
+            p = line + 1;
+            ev->data->chunk = n;
+            ev->data->chunked = n ? CHUNK_DATA : CHUNK_TRAILER;
+            break;
+        case CHUNK_DATA:
+            len = (uint64_t)(end - p) < ev->data->chunk ? (uint32_t)(end - p) : (uint32_t)ev->data->chunk;
+            ret = upload_write(ev->data->sink, p, len);
+            if (ret != SUCC)
+                return ret;
+            p += len;
+            ev->data->chunk -= len;
+            if (!ev->data->chunk)
+                ev->data->chunked = CHUNK_DATA_END;
+            break;
+        case CHUNK_DATA_END:
+            if (end - p < 2)
             {
-                *ptr = data + i;
-                return 4; // backup last boundary
+                *data = p;
+                return SUCC;
             }
+            if (p[0] != CR || p[1] != LF)
+                return PARA;
+            p += 2;
+            ev->data->chunked = CHUNK_SIZE;
+            break;
+        default:
+            return PARA;
         }
+        *data = p;
     }
+    *data = p;
+    return SUCC;
+}
 
-    return 0;
+static void close_request_body(event_t *ev)
+{
+    // the loop goes on while the writer thread flushes, finish_request_*() follow
+    upload_close(ev->data->sink);
+    ev->data->closing = CLOSE_LAST;
+    event_wait(ev, upload_closed_ready);
 }
 
-static char* local_file_list(char *path)
+static void finish_request_put(event_t *ev)
 {
-    const char* format_dir = "<a href=\"%s/\">%s/</a>" CRLF;
-    const char* format_file = "<a href=\"%s\">%s</a>";
-    WIN32_FIND_DATAA FindFileData;
-    HANDLE hFind;
-    char filter[MAX_PATH] = {0};
-    char *result = NULL;
-    char line[BUFFER_UNIT] = {0};
-    int line_length;
-    int size = BUFFER_UNIT;
-    int offset = 0;
-    char *size_str = NULL;
-    char *utf8 = NULL;
-    int i;
+    ret_code_t ret;
+    char *fields = NULL;
+    int exist;
+    int done = 1;
 
-    sprintf(filter, "%s*", path);
-    // list directory
-    hFind = FindFirstFileA(filter, &FindFileData);
-    if (hFind == INVALID_HANDLE_VALUE) 
+    exist = file_exist(ev->data->rename_to);
+    if (ev->data->mode == UPLOAD_SHARED)
     {
-        log_error("{%s:%d} Invalid File Handle. GetLastError=%d", __FUNCTION__, __LINE__, GetLastError());
-        return NULL;
+        ret = upload_result(ev->data->sink, NULL);
+        ev->data->sink = NULL;
+    }
+    else
+    {
+        // renamed over the target when complete
+        ret = upload_sink_close(ev, "Digest: ");
     }
-    do 
+    if (ev->data->mode == UPLOAD_SHARED)
     {
-        if (FILE_ATTRIBUTE_DIRECTORY & FindFileData.dwFileAttributes)
+        // this range is in, the file is complete once all of them are
+        if (ret == SUCC)
+            ret = upload_range_end(ev->data->rename_to, ev->data->first, ev->data->first + ev->data->total, &done);
+        else
+            upload_range_end(ev->data->rename_to, 0, 0, &done);
+        free(ev->data->rename_to);
+        ev->data->rename_to = NULL;
+    }
+    if (ret == SUCC)
+    {
+        log_info("{%s:%d} put [%s] %s. socket=%d", __FUNCTION__, __LINE__, ev->data->file, done ? "complete" : "range received", ev->fd);
+    }
+    fields = ev->data->digests;
+    ev->data->digests = NULL;
+    release_event_data(ev);
+    ev->status = EV_IDLE;
+    if (ret == SUCC)
+        send_response_fields(ev, !done ? PAGE_202 : exist ? PAGE_UPLOAD_OK : PAGE_201, fields);
+    else
+        send_response(ev, ret == FULL ? PAGE_507 : ret == PARA ? PAGE_400 : PAGE_500);
+    free(fields);
+}
+
+static void request_upload_session(event_t *ev, request_header_t *header, char *id)
+{
+    const char *value = NULL;
+    char path[MAX_PATH] = {0};
+    char session[UPLOAD_SESSION_ID_LEN + 1] = {0};
+    uint64_t length = 0;
+    uint64_t offset = 0;
+    uint64_t content_length = 0;
+    ret_code_t ret;
+
+    if (0 == strcmp(header->method, "POST"))
+    {
+        // POST /.uploads/?path=dir/file with Upload-Length creates a session
+        if (strncmp(id, "?path=", strlen("?path=")) || !id[strlen("?path=")] || id[strlen(id)-1] == '/'
+            || !query_path_valid(id + strlen("?path=")) || strlen(root_path()) + strlen(id) >= MAX_PATH
+            || !(value = request_field(header, "Upload-Length")) || SUCC != str_to_uint64(value, &length))
         {
-            if (!result)
-            {
-                result = (char*)malloc(size);
-            }
-            utf8 = ansi_to_utf8(FindFileData.cFileName);
-            sprintf(line, format_dir, utf8, utf8);
-            line_length = strlen(line);
-            line[line_length] = 0;
-            if (offset+line_length > size-1)
-            {
-                size += BUFFER_UNIT;
-                result = (char*)realloc(result, size);
-            }
-            memcpy(result+offset, line, line_length);
-            offset += line_length;
-            free(utf8);
+            response_http_400_page(ev);
+            return;
+        }
+        sprintf(path, "%s%s", root_path(), id + strlen("?path="));
+        ret = upload_session_create(path, length, session);
+        if (ret != SUCC)
+        {
+            send_response(ev, ret == FULL ? PAGE_507 : PAGE_500);
+            return;
         }
-    } while (FindNextFileA(hFind, &FindFileData));
-    FindClose(hFind);
+        response_upload_offset(ev, "201 Created", 0, length, session);
+        return;
+    }
 
-    // list files
-    hFind = FindFirstFileA(filter, &FindFileData);
-    if (hFind == INVALID_HANDLE_VALUE) 
+    if (SUCC != upload_session_query(id, &offset, &length, path))
     {
-        log_error("{%s:%d} Invalid File Handle. GetLastError=%d", __FUNCTION__, __LINE__, GetLastError());
-        return NULL;
+        response_http_404_page(ev);
+        return;
+    }
+    if (0 == strcmp(header->method, "HEAD"))
+    {
+        // the offset is the size of the part file, it survives restarts
+        response_upload_offset(ev, "200 OK", offset, length, NULL);
     }
-    do 
+    else if (0 == strcmp(header->method, "DELETE"))
     {
-        if (!(FILE_ATTRIBUTE_DIRECTORY & FindFileData.dwFileAttributes))
+        upload_session_delete(id);
+        response_upload_offset(ev, "204 No Content", offset, length, NULL);
+    }
+    else if (0 == strcmp(header->method, "PATCH"))
+    {
+        // PATCH appends the body at Upload-Offset
+        if (!(value = request_field(header, "Upload-Offset")) || SUCC != str_to_uint64(value, &content_length))
         {
-            if (!result)
-            {
-                result = (char*)malloc(size);
-            }
-            utf8 = ansi_to_utf8(FindFileData.cFileName);
-            sprintf(line, format_file, utf8, utf8);
-            line_length = strlen(line);
-            for (i=strlen(FindFileData.cFileName); i<60; i++)
-            {
-                line[line_length++] = ' ';
-            }
-            size_str = uint32_to_str(FindFileData.nFileSizeLow);
-            memcpy(line+line_length, size_str, strlen(size_str));
-            line_length += strlen(size_str);
-            line[line_length++] = CR;
-            line[line_length++] = LF;
-            line[line_length] = 0;
-
-            if (offset+line_length > size-1)
+            response_http_400_page(ev);
+            return;
+        }
+        if (content_length != offset)
+        {
+            response_upload_offset(ev, "409 Conflict", offset, length, NULL);
+            return;
+        }
+        if (!(value = request_field(header, "Content-Length")))
+        {
+            send_response(ev, PAGE_411);
+            return;
+        }
+        if (SUCC != str_to_uint64(value, &content_length) || content_length > length - offset)
+        {
+            response_http_400_page(ev);
+            return;
+        }
+
+        ev->data = (event_data_t*)malloc(sizeof(event_data_t));
+        if (ev->data)
+        {
+            memset(ev->data, 0, sizeof(event_data_t));
+            ev->data->buf = (char*)malloc(UPLOAD_BUFFER_MIN);
+            ev->data->cap = UPLOAD_BUFFER_MIN;
+            ev->data->file = (char*)malloc(MAX_PATH);
+        }
+        if (!ev->data || !ev->data->buf || !ev->data->file)
+        {
+            release_event_data(ev);
+            response_http_500_page(ev);
+            return;
+        }
+        ret = upload_open(path, UPLOAD_APPEND, offset, length, &ev->data->sink);
+        if (ret == EXIS)
+        {
+            // a dropped connection of this session, the writer thread still closes the part file
+            release_event_data(ev);
+            send_response_fields(ev, PAGE_503, "Retry-After: 1" CRLF);
+            return;
+        }
+        if (ret != SUCC)
+        {
+            release_event_data(ev);
+            send_response(ev, ret == FULL ? PAGE_507 : PAGE_500);
+            return;
+        }
+        memcpy(ev->data->file, path, strlen(path) + 1);
+        ev->data->mode = UPLOAD_APPEND;
+        ev->data->total = content_length;
+        ev->data->offset = 0;
+        ev->status = EV_BUSY;
+
+        if ((value = request_field(header, "Expect")) && 0 == _stricmp(value, "100-continue"))
+        {
+            network_write(ev->fd, "HTTP/1.1 100 Continue" CRLF CRLF, sizeof("HTTP/1.1 100 Continue" CRLF CRLF) - 1);
+        }
+        if (!content_length)
+        {
+            close_request_body(ev);
+        }
+    }
+    else
+    {
+        response_http_501_page(ev);
+    }
+}
+
+static void finish_request_patch(event_t *ev)
+{
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    ret_code_t ret;
+
+    ret = upload_result(ev->data->sink, NULL);
+    ev->data->sink = NULL;
+    if (ret == SUCC)
+    {
+        // renamed to the target once the last byte is in
+        ret = upload_session_commit(ev->data->file, &offset, &length);
+    }
+    release_event_data(ev);
+    ev->status = EV_IDLE;
+    if (ret == SUCC)
+        response_upload_offset(ev, "204 No Content", offset, length, NULL);
+    else
+        send_response(ev, ret == FULL ? PAGE_507 : PAGE_500);
+}
+
+static ret_code_t upload_sink_close(event_t *ev, const char *field)
+{
+    hash_digest_t digest;
+    char *digests = NULL;
+    uint32_t len = 0;
+    ret_code_t ret;
+
+    // closed by the writer thread already
+    ret = upload_result(ev->data->sink, &digest);
+    ev->data->sink = NULL;
+    if (ret == SUCC && ev->data->expect && memcmp(ev->data->expect, digest.sha256, SHA256_SIZE))
+    {
+        log_warn("{%s:%d} [%s] does not match the digest sent by the client. socket=%d", __FUNCTION__, __LINE__, ev->data->file, ev->fd);
+        // a put removes its temp file with the event data
+        if (!ev->data->rename_to)
+            DeleteFileA(ev->data->file);
+        ret = PARA;
+    }
+    free(ev->data->expect);
+    ev->data->expect = NULL;
+    if (ret != SUCC)
+        return ret;
+
+    // the content is stored once, the name becomes a link to it
+    if (UPLOAD_DEDUP && FAIL == (ret = upload_blob_store(ev->data->file, &digest)))
+        return FAIL;
+
+    // kept with the file for downloads, a failure only costs the Digest field.
+    // upload_blob_store has saved it already
+    if (!UPLOAD_DEDUP)
+        hash_save(ev->data->file, &digest);
+
+    // the complete file replaces the target in one step
+    if (SUCC != upload_commit(ev->data->file, ev->data->rename_to))
+        return FAIL;
+    free(ev->data->rename_to);
+    ev->data->rename_to = NULL;
+
+    // one field per file, the response header has room for a few of them
+    if (ev->data->digests)
+        len = strlen(ev->data->digests);
+    if (len + strlen(field) + HASH_DIGEST_LEN + sizeof(CRLF) > BUFFER_UNIT / 2)
+        return SUCC;
+    digests = (char*)realloc(ev->data->digests, len + strlen(field) + HASH_DIGEST_LEN + sizeof(CRLF));
+    if (!digests)
+        return SUCC;
+    ev->data->digests = digests;
+    len += sprintf(digests + len, "%s", field);
+    len += hash_format(&digest, digests + len);
+    memcpy(digests + len, CRLF, sizeof(CRLF));
+    return SUCC;
+}
+
+static int upload_buffer_compact(event_t *ev, char *data, char *end, int full)
+{
+    char *buf = NULL;
+
+    // only unparsed bytes are kept, at the front of the buffer
+    ev->data->size = end - data;
+    if (ev->data->size && data != ev->data->buf)
+    {
+        memmove(ev->data->buf, data, ev->data->size);
+    }
+
+    // the client filled the whole buffer, let it send more per callback
+    if (full || ev->data->cap - ev->data->size < BUFFER_UNIT)
+    {
+        if (ev->data->cap < UPLOAD_BUFFER_MAX)
+        {
+            buf = (char*)realloc(ev->data->buf, ev->data->cap * 2);
+            if (buf)
             {
-                size += BUFFER_UNIT;
-                result = (char*)realloc(result, size);
+                ev->data->buf = buf;
+                ev->data->cap *= 2;
             }
-            memcpy(result+offset, line, line_length);
-            offset += line_length;
-            free(utf8);
         }
-    } while (FindNextFileA(hFind, &FindFileData));
-    FindClose(hFind);
-    result[offset] = 0;
-
-    return result;
+        if (ev->data->cap == ev->data->size)
+            return 0;
+    }
+    return 1;
 }
 
-static const char *reponse_content_type(char *file_name)
+static const char *request_field(request_header_t *header, const char *key)
 {
-    const request_fields_t content_type[] =     {
-        { "html",   "text/html"                 },
-        { "css",    "text/css"                  },
-        { "txt",    "text/plain"                },
-        { "log",    "text/plain"                },
-        { "cpp",    "text/plain"                },
-        { "c",      "text/plain"                },
-        { "h",      "text/plain"                },
-        { "js",     "application/x-javascript"  },
-        { "png",    "application/x-png"         },
-        { "jpg",    "image/jpeg"                },
-        { "jpeg",   "image/jpeg"                },
-        { "jpe",    "image/jpeg"                },
-        { "gif",    "image/gif"                 },
-        { "ico",    "image/x-icon"              },
-        { "doc",    "application/msword"        },
-        { "docx",   "application/msword"        },
-        { "ppt",    "application/x-ppt"         },
-        { "pptx",   "application/x-ppt"         },
-        { "xls",    "application/x-xls"         },
-        { "xlsx",   "application/x-xls"         },
-        { "mp4",    "video/mpeg4"               },
-        { "mp3",    "audio/mp3"                 }
-    };
-
-    char *ext = NULL;
     int i;
 
+    for (i=0; i<header->fields_count; i++)
+    {
+        if (0 == _stricmp(header->fields[i].key, key))
+            return header->fields[i].value;
+    }
+    return NULL;
+}
+
+static int upload_ready(event_t *ev)
+{
+    return !ev->data || !ev->data->sink || !upload_busy(ev->data->sink);
+}
+
+static int upload_closed_ready(event_t *ev)
+{
+    return !ev->data || !ev->data->sink || upload_closed(ev->data->sink);
+}
+
+static uint64_t upload_expected(event_t *ev, uint64_t rest)
+{
+    uint32_t closing;
+
+    // body bytes from the start of the file data, less the closing delimiter.
+    // later parts make this an overestimate, the file is trimmed on close
+    closing = ev->data->boundary->length + 4;
+    return rest > closing ? rest - closing : 0;
+}
+
+static int reset_filename_from_formdata(event_t *ev, char **formdata, int size)
+{
+    char *file_name = NULL;
+    char *p         = NULL;
+    char *name      = NULL;
+    int   i         = 0;
+    int   found     = 0;
+    char *anis      = NULL;
+
+    // find "\r\n\r\n"
+    p = *formdata;
+    for (int i = 0; i <= size-4; i++)
+    {
+        if (0 == memcmp(*formdata + i, CRLF CRLF, strlen(CRLF CRLF)))
+        {
+            found = 1;
+            (*formdata)[i] = 0;
+            (*formdata) += i + strlen(CRLF CRLF);
+            break;
+        }
+    }
+    if (!found)
+        return 2;
+
+    // a part may carry the digest of its content
+    if ((file_name = strstr(p, "Digest:")))
+    {
+        free(ev->data->expect);
+        ev->data->expect = (uint8_t*)malloc(SHA256_SIZE);
+        if (ev->data->expect && !hash_parse_sha256(file_name + strlen("Digest:"), ev->data->expect))
+        {
+            free(ev->data->expect);
+            ev->data->expect = NULL;
+        }
+    }
+
+    // file upload file name from formdata
+    file_name = strstr(p, "filename=\"");
     if (!file_name)
+        return 0;
+    file_name += strlen("filename=\"");
+    *strstr(file_name, "\"") = 0;
+
+    anis = utf8_to_ansi(file_name);
+
+    // IE browser: remove client file path
+    p = name = anis;
+    while (*p)
     {
-        return "text/html";
+        if (*p == '\\' || *p == '/')
+        if (*(p + 1))
+            name = p + 1;
+        p++;
     }
-    ext = file_ext(file_name);
-    if (ext)
+
+    // reset filepath
+    for (i = strlen(ev->data->file) - 1; i >= 0; i--)
     {
-        for (i=0; i<sizeof(content_type)/sizeof(content_type[0]); i++)
+        if (ev->data->file[i] == '/')
+            break;
+    }
+    if (i + 1 + strlen(name) + sizeof(".4294967295.part") > MAX_PATH
+        || (!ev->data->rename_to && !(ev->data->rename_to = (char*)malloc(MAX_PATH))))
+    {
+        free(anis);
+        return 0;
+    }
+
+    // written next to the target and renamed over it when complete, the
+    // old file stays readable until then
+    memcpy(ev->data->rename_to, ev->data->file, i + 1);
+    memcpy(ev->data->rename_to + i + 1, name, strlen(name) + 1);
+    sprintf(ev->data->file, "%s.%u.part", ev->data->rename_to, ev->fd);
+    free(anis);
+    return 1;
+}
+
+static char* local_file_list(arena_t *arena, cache_t *dc)
+{
+    cache_entry_t *entry = NULL;
+    char *result = NULL;
+    char *p = NULL;
+    uint32_t size = 1;
+    uint32_t i;
+    int j;
+
+    // the whole page is bounded up front, rendered in one pass without a line buffer
+    for (i=0; i<dc->count; i++)
+    {
+        size += dc->entries[i].name_len * 2 + 100;
+    }
+    result = (char*)arena_alloc(arena, size);
+    if (!result)
+        return NULL;
+    p = result;
+    for (i=0; i<dc->count; i++)
+    {
+        entry = dc->entries + i;
+        memcpy(p, "<a href=\"", 9);
+        p += 9;
+        memcpy(p, entry->name, entry->name_len);
+        p += entry->name_len;
+        if (entry->dir)
         {
-            if (0 == strcmp(content_type[i].key, ext))
-            {
-                return content_type[i].value;
-            }
+            memcpy(p, "/\">", 3);
+            p += 3;
+            memcpy(p, entry->name, entry->name_len);
+            p += entry->name_len;
+            memcpy(p, "/</a>" CRLF, 7);
+            p += 7;
+            continue;
+        }
+        memcpy(p, "\">", 2);
+        p += 2;
+        memcpy(p, entry->name, entry->name_len);
+        p += entry->name_len;
+        memcpy(p, "</a>", 4);
+        p += 4;
+        for (j=entry->name_len; j<60; j++)
+        {
+            *p++ = ' ';
         }
+        p += uint64_to_buf(entry->size, p);
+        *p++ = CR;
+        *p++ = LF;
     }
-    return "application/octet-stream";
+    *p = 0;
+
+    return result;
 }
 
-static const char *response_header_format()
+static int json_escape(const char *str, char *buf)
 {
-    const char *http_header_format =
-        "HTTP/1.1 %s" CRLF
-        "Content-Type: %s" CRLF
-        "Content-Length: %d" CRLF
-        CRLF;
+    char *p = buf;
+
+    // at most 6 bytes for every byte of str
+    for (; *str; str++)
+    {
+        if (*str == '"' || *str == '\\')
+        {
+            *p++ = '\\';
+            *p++ = *str;
+        }
+        else if ((uint8_t)*str < 0x20)
+        {
+            p += sprintf(p, "\\u%04x", (uint8_t)*str);
+        }
+        else
+        {
+            *p++ = *str;
+        }
+    }
+    *p = 0;
+    return p - buf;
+}
+
+static int query_param(const char *query, const char *key, char *value, int size)
+{
+    const char *p = query;
+    const char *end = NULL;
+    int len = strlen(key);
+
+    // "key=value&key=value", -1 if missing or longer than size
+    while (p && *p)
+    {
+        end = strchr(p, '&');
+        if (0 == strncmp(p, key, len) && p[len] == '=')
+        {
+            p += len + 1;
+            len = end ? (int)(end - p) : (int)strlen(p);
+            if (len >= size)
+                return -1;
+            memcpy(value, p, len);
+            value[len] = 0;
+            return len;
+        }
+        p = end ? end + 1 : NULL;
+    }
+    return -1;
+}
 
-    return http_header_format;
+static const char *reponse_content_type(char *file_name)
+{
+    if (!file_name)
+    {
+        return "text/html";
+    }
+    return mime_type(file_name);
 }
 
 static const char *response_body_format()
@@ -981,6 +1872,82 @@ static const char *response_body_format()
     return http_body_format;
 }
 
+static void response_init()
+{
+    response_fixed_t *page = NULL;
+    int i;
+
+    for (i=0; i<PAGE_MAX; i++)
+    {
+        page = _pages + i;
+        page->body_size = sprintf(page->body, response_body_format(), page->title, page->title);
+        page->header_size = sprintf(page->header, "HTTP/1.1 %s" CRLF "Content-Type: %s" CRLF "Content-Length: %u" CRLF,
+            page->status ? page->status : page->title, reponse_content_type(NULL), page->body_size);
+    }
+}
+
+static const char *response_date()
+{
+    static const char *days[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+    static const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+    static char   date[HTTP_DATE_SIZE + 1] = {0};
+    static time_t last = 0;
+    time_t now = time(NULL);
+    struct tm *t;
+
+    // Date line and the blank line ending the header, formatted once per second
+    if (now != last)
+    {
+        last = now;
+        t = gmtime(&now);
+        sprintf(date, "Date: %s, %02d %s %04d %02d:%02d:%02d GMT" CRLF CRLF, days[t->tm_wday], t->tm_mday,
+            months[t->tm_mon], t->tm_year + 1900, t->tm_hour, t->tm_min, t->tm_sec);
+    }
+    return date;
+}
+
+static int response_header_prefix(char *buf, const char *status, const char *type, uint64_t length, cache_t *fc)
+{
+#define APPEND(p, s, len) do { memcpy(p, s, len); p += len; } while (0)
+#define APPEND_STR(p, s)  APPEND(p, s, sizeof(s) - 1)
+
+    char *p = buf;
+    uint64_t mtime;
+
+    APPEND(p, status, strlen(status));
+    APPEND_STR(p, "Content-Type: ");
+    APPEND(p, type, strlen(type));
+    APPEND_STR(p, CRLF "Content-Length: ");
+    p += uint64_to_buf(length, p);
+    APPEND_STR(p, CRLF);
+    if (fc)
+    {
+        mtime = ((uint64_t)fc->mtime.dwHighDateTime << 32) | fc->mtime.dwLowDateTime;
+        APPEND_STR(p, "ETag: \"");
+        p += uint64_to_hex(mtime, p);
+        *p++ = '-';
+        p += uint64_to_hex(fc->size, p);
+        APPEND_STR(p, "\"" CRLF);
+        if (fc->digest)
+        {
+            APPEND_STR(p, "Digest: ");
+            APPEND(p, fc->digest, strlen(fc->digest));
+            APPEND_STR(p, CRLF);
+        }
+    }
+    *p = 0;
+    return p - buf;
+}
+
+static int response_header(char *buf, const char *status, const char *type, uint64_t length, cache_t *fc)
+{
+    int len;
+
+    len = response_header_prefix(buf, status, type, length, fc);
+    memcpy(buf + len, response_date(), HTTP_DATE_SIZE + 1);
+    return len + HTTP_DATE_SIZE;
+}
+
 static void response_home_page(event_t *ev, char *path)
 {
     const char *html_format = 
@@ -998,31 +1965,67 @@ static void response_home_page(event_t *ev, char *path)
         "</body></html>";
 
     char header[BUFFER_UNIT] = { 0 };
+    char dir_path[MAX_PATH] = { 0 };
     event_data_t* ev_data = NULL;
     int length;
+    cache_t *dc = NULL;
     char *file_list = NULL;
     char *html = NULL;
     event_t ev_ = {0};
     char *utf8 = NULL;
 
-    utf8 = ansi_to_utf8(path);
-    file_list = local_file_list(path);
-    if (!file_list)
+    if (strlen(root_path()) + strlen(path) >= MAX_PATH)
+    {
+        response_http_404_page(ev);
+        return;
+    }
+    memcpy(dir_path, root_path(), strlen(root_path()));
+    memcpy(dir_path+strlen(dir_path), path, strlen(path));
+    dc = cache_open_dir(dir_path);
+    if (!dc)
+    {
+        response_http_404_page(ev);
         return;
+    }
 
-    length = strlen(html_format) + strlen(file_list) + (strlen(utf8) - strlen("%s"))*3 + 1;
-    html = (char*)malloc(length);
-    if (!html)
+    if (!dc->content)
     {
-        log_error("{%s:%d} malloc fail.", __FUNCTION__, __LINE__);
+        // render once, repeated hits send the cached page
+        file_list = local_file_list(CONN_ARENA(ev), dc);
+        if (!file_list)
+        {
+            cache_close(dc);
+            response_http_500_page(ev);
+            return;
+        }
+        utf8 = ansi_to_utf8(path);
+        length = strlen(html_format) + strlen(file_list) + (strlen(utf8) - strlen("%s"))*3 + 1;
+        html = (char*)malloc(length);
+        if (!html)
+        {
+            log_error("{%s:%d} malloc fail.", __FUNCTION__, __LINE__);
+            free(utf8);
+            cache_close(dc);
+            response_http_500_page(ev);
+            return;
+        }
+        sprintf(html, html_format, utf8, utf8, utf8, file_list);
+        free(utf8);
+        cache_set_content(dc, html, strlen(html));
+    }
+    if (!dc->header)
+    {
+        response_header_prefix(header, HTTP_200, reponse_content_type(NULL), dc->size, NULL);
+        cache_set_header(dc, header);
+    }
+    ev_data = dc->header ? create_event_data(NULL, NULL) : NULL;
+    if (!ev_data)
+    {
+        cache_close(dc);
+        response_http_500_page(ev);
         return;
     }
-    sprintf(html, html_format, utf8, utf8, utf8, file_list);
-    free(utf8);
-    free(file_list);
-    sprintf(header, response_header_format(), "200 OK", reponse_content_type(NULL), strlen(html));
-    ev_data = create_event_data(header, html);
-    free(html);
+    ev_data->fc = dc;
 
     ev_.fd = ev->fd;
     ev_.ip = ev->ip;
@@ -1036,40 +2039,295 @@ static void response_home_page(event_t *ev, char *path)
 static void response_send_file_page(event_t *ev, char *file_name)
 {
     char header[BUFFER_UNIT] = { 0 };
-    FILE* fp = NULL;
-    int total;
-    int len;
+    cache_t *fc = NULL;
     event_data_t* ev_data = NULL;
     event_t ev_ = {0};
 
-    fp = fopen(file_name, "rb");
-    if (!fp)
+    // the handle stays open for the whole transfer
+    fc = cache_open(file_name);
+    if (!fc)
     {
-        log_error("{%s:%d} open [%s] failed, errno=%d", __FUNCTION__, __LINE__, file_name, errno);
-        release_event_data(ev);
         response_http_404_page(ev);
-        goto end;
+        return;
     }
-    if (ev->data == NULL)
+    if (fc->content)
     {
-        fseek(fp, 0, SEEK_END);
-        total = ftell(fp);
-        fseek(fp, 0, SEEK_SET);
-        len = total > BUFFER_UNIT ? BUFFER_UNIT : total;
-        sprintf(header, response_header_format(), "200 OK", reponse_content_type(file_name), total);
-        ev_data = create_event_data_fp(header, fp, len, total);
-        memcpy(ev_data->file, file_name, strlen(file_name));
-        ev_data->offset += len;
+        // served from memory, write_callback sends header and content
+        if (!fc->header)
+        {
+            response_header_prefix(header, HTTP_200, fc->mime, fc->size, fc);
+            cache_set_header(fc, header);
+        }
+        ev_data = fc->header ? create_event_data(NULL, NULL) : NULL;
     }
     else
     {
-        fseek(fp, ev->data->offset, SEEK_SET);
-        len = ev->data->total - ev->data->offset > BUFFER_UNIT ? BUFFER_UNIT : ev->data->total - ev->data->offset;
-        ev_data = create_event_data_fp(NULL, fp, len, ev->data->total);
-        memcpy(ev_data->file, file_name, strlen(file_name));
-        ev_data->offset = ev->data->offset + len;
+        // the header waits in the event data, file bytes are read at send time
+        response_header(header, HTTP_200, fc->mime, fc->size, fc);
+        ev_data = create_event_data(header, NULL);
+    }
+    if (!ev_data)
+    {
+        cache_close(fc);
+        response_http_500_page(ev);
+        return;
+    }
+    ev_data->fc = fc;
+    ev_data->total = fc->size;
+    ev_data->offset = 0;
+
+    ev_.fd = ev->fd;
+    ev_.ip = ev->ip;
+    ev_.type = EV_WRITE;
+    ev_.param = ev->param;
+    ev_.data = ev_data;
+    ev_.callback = write_callback;
+    event_add(&ev_);
+}
+
+static void send_file(event_t *ev)
+{
+    event_data_t *data = ev->data;
+    char *buf = NULL;
+    uint32_t len;
+    uint32_t n;
+    uint32_t sent = 0;
+
+    // a pooled buffer is held only while its bytes are sent
+    buf = iobuf_get();
+    if (!buf)
+        goto fail;
+    len = data->size;
+    memcpy(buf, data->data, len);
+    n = data->total - data->offset > IOBUF_SIZE - len ? IOBUF_SIZE - len : (uint32_t)(data->total - data->offset);
+    // whatever the socket takes now, the rest is read again on the next writable event
+    if (SUCC != cache_read(data->fc, data->offset, buf + len, n) || SUCC != network_write_some(ev->fd, buf, len + n, &sent))
+        goto fail;
+    iobuf_put(buf);
+    if (sent < len)
+    {
+        memmove(data->data, data->data + sent, len - sent);
+        data->size = len - sent;
+        send_again(ev);
+        return;
+    }
+    data->size = 0;
+    n = sent - len;
+    // one line per percent, not per chunk
+    if (LOG_ENABLED(LOG_DEBU) && data->total && (data->offset + n) * 100 / data->total != data->offset * 100 / data->total)
+        log_debug("{%s:%d} send file. progress=%d%%, socket=%d", __FUNCTION__, __LINE__, (int)((data->offset + n) * 100 / data->total), ev->fd);
+    data->offset += n;
+    if (data->offset == data->total)
+    {
+        log_info("{%s:%d} send response completed. socket=%d", __FUNCTION__, __LINE__, ev->fd);
         release_event_data(ev);
+        return;
+    }
+    send_again(ev);
+    return;
+
+fail:
+    // the header may be out already, nothing to answer
+    iobuf_put(buf);
+    shutdown(ev->fd, SD_SEND);
+    release_event_data(ev);
+}
+
+static void send_again(event_t *ev)
+{
+    event_t ev_ = {0};
+
+    // the same event data continues when the socket is writable again
+    ev_.fd = ev->fd;
+    ev_.ip = ev->ip;
+    ev_.type = EV_WRITE;
+    ev_.param = ev->param;
+    ev_.data = ev->data;
+    ev_.callback = write_callback;
+    ev->data = NULL;
+    event_add(&ev_);
+}
+
+static void response_dir_query(event_t *ev, char *path, const char *query)
+{
+    char value[16];
+
+    if (query_param(query, "archive", value, sizeof(value)) >= 0)
+        response_archive_page(ev, path, value);
+    else if (query_param(query, "format", value, sizeof(value)) >= 0 && 0 == strcmp(value, "json"))
+        response_json_list(ev, path, query);
+    else
+        response_home_page(ev, path);
+}
+
+static void response_json_list(event_t *ev, char *path, const char *query)
+{
+    static const char *sorts[CACHE_SORT_MAX] = { "name", "size", "mtime" };
+    char header[BUFFER_UNIT] = { 0 };
+    char dir_path[MAX_PATH] = { 0 };
+    char value[24];
+    cache_t *dc = NULL;
+    cache_entry_t **sorted = NULL;
+    cache_entry_t *entry = NULL;
+    uint32_t sort = CACHE_SORT_NAME;
+    uint64_t offset = 0;
+    uint64_t limit = LIST_LIMIT_DEFAULT;
+    uint64_t mtime;
+    uint32_t i, end;
+    uint32_t length;
+    char *utf8 = NULL;
+    char *body = NULL;
+    char *p = NULL;
+
+    if ((query_param(query, "offset", value, sizeof(value)) >= 0 && SUCC != str_to_uint64(value, &offset))
+        || (query_param(query, "limit", value, sizeof(value)) >= 0 && SUCC != str_to_uint64(value, &limit)))
+    {
+        response_http_400_page(ev);
+        return;
+    }
+    if (query_param(query, "sort", value, sizeof(value)) >= 0)
+    {
+        for (sort = 0; sort < CACHE_SORT_MAX && strcmp(value, sorts[sort]); sort++);
+        if (sort == CACHE_SORT_MAX)
+        {
+            response_http_400_page(ev);
+            return;
+        }
+    }
+    if (!limit || limit > LIST_LIMIT_MAX)
+        limit = LIST_LIMIT_MAX;
+    if (strlen(root_path()) + strlen(path) >= MAX_PATH)
+    {
+        response_http_404_page(ev);
+        return;
+    }
+    memcpy(dir_path, root_path(), strlen(root_path()));
+    memcpy(dir_path+strlen(dir_path), path, strlen(path));
+    dc = cache_open_dir(dir_path);
+    if (!dc)
+    {
+        response_http_404_page(ev);
+        return;
+    }
+
+    // a page is a slice of the cached order, nothing is sorted per request
+    sorted = cache_sorted(dc, (cache_sort_t)sort);
+    utf8 = ansi_to_utf8(path);
+    if ((!sorted && dc->count) || !utf8)
+    {
+        free(utf8);
+        cache_close(dc);
+        response_http_500_page(ev);
+        return;
+    }
+    if (offset > dc->sorted_count)
+        offset = dc->sorted_count;
+    end = dc->sorted_count - (uint32_t)offset > limit ? (uint32_t)(offset + limit) : dc->sorted_count;
+    length = 128 + strlen(utf8) * 6;
+    for (i = (uint32_t)offset; i < end; i++)
+    {
+        length += strlen(sorted[i]->name) * 6 + 96;
+    }
+    body = (char*)arena_alloc(CONN_ARENA(ev), length);
+    if (!body)
+    {
+        free(utf8);
+        cache_close(dc);
+        response_http_500_page(ev);
+        return;
+    }
+
+    p = body;
+    p += sprintf(p, "{\"path\":\"/");
+    p += json_escape(utf8, p);
+    p += sprintf(p, "\",\"sort\":\"%s\",\"total\":%u,\"offset\":%u,\"count\":%u,\"entries\":[",
+        sorts[sort], dc->sorted_count, (uint32_t)offset, end - (uint32_t)offset);
+    for (i = (uint32_t)offset; i < end; i++)
+    {
+        entry = sorted[i];
+        mtime = entry->mtime > 116444736000000000ULL ? (entry->mtime - 116444736000000000ULL) / 10000000 : 0;
+        p += sprintf(p, "%s" CRLF "{\"name\":\"", i == offset ? "" : ",");
+        p += json_escape(entry->name, p);
+        p += sprintf(p, "\",\"dir\":%s,\"size\":", entry->dir ? "true" : "false");
+        p += uint64_to_buf(entry->dir ? 0 : entry->size, p);
+        p += sprintf(p, ",\"mtime\":");
+        p += uint64_to_buf(mtime, p);
+        *p++ = '}';
+    }
+    p += sprintf(p, "]}" CRLF);
+    free(utf8);
+    cache_close(dc);
+
+    response_header(header, HTTP_200, "application/json; charset=utf-8", p - body, NULL);
+    send_header(ev, header, body);
+}
+
+static void response_archive_page(event_t *ev, char *path, const char *format)
+{
+    char header[BUFFER_UNIT] = { 0 };
+    char dir_path[MAX_PATH] = { 0 };
+    event_data_t* ev_data = NULL;
+    archive_t *archive = NULL;
+    archive_format_t type;
+    event_t ev_ = {0};
+    char *utf8 = NULL;
+    char *name = NULL;
+    char *p = NULL;
+    int len;
+
+    if (0 == strcmp(format, "tar"))
+        type = ARCHIVE_TAR;
+    else if (0 == strcmp(format, "zip"))
+        type = ARCHIVE_ZIP;
+    else
+    {
+        response_http_400_page(ev);
+        return;
     }
+    if (strlen(root_path()) + strlen(path) >= MAX_PATH)
+    {
+        response_http_404_page(ev);
+        return;
+    }
+    memcpy(dir_path, root_path(), strlen(root_path()));
+    memcpy(dir_path+strlen(dir_path), path, strlen(path));
+    archive = archive_open(dir_path, type);
+    if (!archive)
+    {
+        response_http_404_page(ev);
+        return;
+    }
+
+    utf8 = ansi_to_utf8(path);
+    if (!utf8)
+    {
+        archive_close(archive);
+        response_http_500_page(ev);
+        return;
+    }
+
+    // last component of the directory names the download
+    len = strlen(utf8);
+    if (len)
+        utf8[--len] = 0;
+    name = strrchr(utf8, '/');
+    name = name ? name + 1 : (len ? utf8 : "root");
+    p = header;
+    p += sprintf(p, HTTP_200 "Content-Type: %s" CRLF "Transfer-Encoding: chunked" CRLF
+        "Content-Disposition: attachment; filename=\"%s.%s\"" CRLF,
+        type == ARCHIVE_TAR ? "application/x-tar" : "application/zip", name, format);
+    memcpy(p, response_date(), HTTP_DATE_SIZE + 1);
+    free(utf8);
+
+    // the header goes out first, archive bytes are generated at send time
+    ev_data = create_event_data(header, NULL);
+    if (!ev_data)
+    {
+        archive_close(archive);
+        response_http_500_page(ev);
+        return;
+    }
+    ev_data->archive = archive;
 
     ev_.fd = ev->fd;
     ev_.ip = ev->ip;
@@ -1078,53 +2336,170 @@ static void response_send_file_page(event_t *ev, char *file_name)
     ev_.data = ev_data;
     ev_.callback = write_callback;
     event_add(&ev_);
+}
+
+static void send_archive(event_t *ev)
+{
+    TRANSMIT_FILE_BUFFERS tfb;
+    archive_span_t span;
+    LARGE_INTEGER pos;
+    LARGE_INTEGER size;
+    char line[ARCHIVE_CHUNK_LINE];
+    char *buf = NULL;
+    char *payload = NULL;
+    uint32_t len = 0;
+    int n;
+
+    if (ev->data->size)
+    {
+        if (SUCC != network_write(ev->fd, ev->data->data, ev->data->size))
+            goto fail;
+        ev->data->size = 0;
+    }
+    buf = iobuf_get();
+    if (!buf)
+        goto fail;
+    payload = buf + ARCHIVE_CHUNK_LINE;
+    // a small slice per event like send_file, a blocking TransmitFile of it returns at once
+    if (SUCC != archive_read(ev->data->archive, payload, SEND_SLICE, &len, &span))
+        goto fail;
+    if (!len && !span.length)
+    {
+        // last chunk, no trailer
+        iobuf_put(buf);
+        buf = NULL;
+        if (SUCC != network_write(ev->fd, "0" CRLF CRLF, sizeof("0" CRLF CRLF) - 1))
+            goto fail;
+        log_info("{%s:%d} send archive completed. socket=%d", __FUNCTION__, __LINE__, ev->fd);
+        release_event_data(ev);
+        return;
+    }
+
+    // chunk size line right before the generated bytes, one chunk per send
+    n = sprintf(line, "%x" CRLF, len + span.length);
+    memcpy(payload - n, line, n);
+    if (!span.length)
+    {
+        memcpy(payload + len, CRLF, sizeof(CRLF) - 1);
+        if (SUCC != network_write(ev->fd, payload - n, n + len + sizeof(CRLF) - 1))
+            goto fail;
+    }
+    else
+    {
+        // file bytes of a large member go from the cache to the socket, headers ride along
+        pos.QuadPart = span.offset;
+        tfb.Head = payload - n;
+        tfb.HeadLength = n + len;
+        tfb.Tail = CRLF;
+        tfb.TailLength = sizeof(CRLF) - 1;
+        if (!SetFilePointerEx(span.file, pos, NULL, FILE_BEGIN)
+            || !TransmitFile(ev->fd, span.file, span.length, 0, NULL, &tfb, 0))
+        {
+            log_error("{%s:%d} TransmitFile fail. socket=%d, WSAGetLastError=%d", __FUNCTION__, __LINE__, ev->fd, WSAGetLastError());
+            goto fail;
+        }
+        // TransmitFile stops at the end of file, a file cut short meanwhile left the chunk incomplete
+        if (!GetFileSizeEx(span.file, &size) || (uint64_t)size.QuadPart < span.offset + span.length)
+        {
+            log_error("{%s:%d} member shrank while sent. socket=%d", __FUNCTION__, __LINE__, ev->fd);
+            goto fail;
+        }
+    }
+    iobuf_put(buf);
+    send_again(ev);
+    return;
 
-end:
-    if (fp)
-        fclose(fp);
+fail:
+    iobuf_put(buf);
+    shutdown(ev->fd, SD_SEND);
+    release_event_data(ev);
 }
 
-static void response_upload_page(event_t *ev, int result)
+static void response_upload_page(event_t *ev, ret_code_t result, const char *fields)
 {
-    if (result)
+    if (result == SUCC)
+    {
+        send_response_fields(ev, PAGE_UPLOAD_OK, fields);
+    }
+    else if (result == FULL)
     {
-        send_response(ev, "Upload completed", "200 OK");
+        send_response(ev, PAGE_507);
+    }
+    else if (result == PARA)
+    {
+        // the content does not match its digest
+        send_response(ev, PAGE_400);
     }
     else
     {
-        send_response(ev, "Upload failed", "200 OK");
+        send_response(ev, PAGE_UPLOAD_FAIL);
     }
 }
 
 static void response_http_400_page(event_t *ev)
 {
-    send_response(ev, "400 Bad Request", NULL);
+    send_response(ev, PAGE_400);
 }
 
 static void response_http_404_page(event_t *ev)
 {
-    send_response(ev, "404 Not Found", NULL);
+    send_response(ev, PAGE_404);
 }
 
 static void response_http_500_page(event_t *ev)
 {
-    send_response(ev, "500 Internal Server Error", NULL);
+    send_response(ev, PAGE_500);
 }
 
 static void response_http_501_page(event_t *ev)
 {
-    send_response(ev, "501 Not Implemented", NULL);
+    send_response(ev, PAGE_501);
 }
 
-static void send_response(event_t *ev, char *title, char *status)
+static void response_upload_offset(event_t *ev, const char *status, uint64_t offset, uint64_t length, const char *id)
 {
     char header[BUFFER_UNIT] = { 0 };
-    char body[BUFFER_UNIT]   = { 0 };
+    char *p = header;
+
+    p += sprintf(p, "HTTP/1.1 %s" CRLF "Cache-Control: no-store" CRLF "Upload-Offset: ", status);
+    p += uint64_to_buf(offset, p);
+    p += sprintf(p, CRLF "Upload-Length: ");
+    p += uint64_to_buf(length, p);
+    p += sprintf(p, CRLF);
+    if (id)
+        p += sprintf(p, "Location: /" UPLOAD_SESSION_DIR "/%s" CRLF, id);
+    if (strncmp(status, "204", 3))
+        p += sprintf(p, "Content-Length: 0" CRLF);
+    memcpy(p, response_date(), HTTP_DATE_SIZE + 1);
+    send_header(ev, header, NULL);
+}
+
+static void send_response(event_t *ev, response_page_t page)
+{
+    send_response_fields(ev, page, NULL);
+}
+
+static void send_response_fields(event_t *ev, response_page_t page, const char *fields)
+{
+    char header[BUFFER_UNIT] = { 0 };
+    uint32_t len = _pages[page].header_size;
+
+    memcpy(header, _pages[page].header, len);
+    if (fields)
+    {
+        // CRLF terminated lines, at most half of the buffer
+        memcpy(header + len, fields, strlen(fields));
+        len += strlen(fields);
+    }
+    memcpy(header + len, response_date(), HTTP_DATE_SIZE + 1);
+    send_header(ev, header, _pages[page].body);
+}
+
+static void send_header(event_t *ev, const char *header, const char *body)
+{
     event_data_t* ev_data = NULL;
     event_t ev_ = {0};
 
-    sprintf(body, response_body_format(), title, title);
-    sprintf(header, response_header_format(), status ? status : title, reponse_content_type(NULL), strlen(body));
     ev_data = create_event_data(header, body);
 
     ev_.fd = ev->fd;
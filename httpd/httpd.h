@@ -25,8 +25,16 @@
 #include <time.h>
 #include "types.h"
 #include "utils.h"
+#include "arena.h"
+#include "iobuf.h"
 #include "Logger.h"
 #include "network.h"
+#include "mime.h"
+#include "cache.h"
+#include "boundary.h"
+#include "hash.h"
+#include "upload.h"
+#include "archive.h"
 #include "event.h"
 #include "http.h"
 
@@ -0,0 +1,115 @@
+#include "httpd.h"
+
+
+// a free buffer keeps the next free one in its first bytes
+typedef struct iobuf_free_t iobuf_free_t;
+struct iobuf_free_t
+{
+    iobuf_free_t           *next;
+};
+
+CRITICAL_SECTION    _iobuf_lock;
+iobuf_free_t       *_iobuf_free     = NULL;
+char               *_iobuf_slabs[IOBUF_MAX_SLABS];
+uint32_t            _iobuf_nslabs   = 0;
+uint32_t            _iobuf_slab     = IOBUF_SLAB;
+
+__declspec(thread) char    *_iobuf_cache[IOBUF_THREAD_CACHE];
+__declspec(thread) uint32_t _iobuf_cached = 0;
+
+static int iobuf_grow();
+
+ret_code_t iobuf_init()
+{
+    size_t large;
+
+    InitializeCriticalSection(&_iobuf_lock);
+    _iobuf_free = NULL;
+    _iobuf_nslabs = 0;
+    _iobuf_slab = IOBUF_SLAB;
+    if (IOBUF_LARGE_PAGES && (large = GetLargePageMinimum()))
+    {
+        // a slab is a whole number of large pages
+        _iobuf_slab = (uint32_t)((IOBUF_SLAB + large - 1) / large * large);
+    }
+    return SUCC;
+}
+
+ret_code_t iobuf_uninit()
+{
+    uint32_t i;
+
+    for (i=0; i<_iobuf_nslabs; i++)
+    {
+        VirtualFree(_iobuf_slabs[i], 0, MEM_RELEASE);
+    }
+    _iobuf_nslabs = 0;
+    _iobuf_free = NULL;
+    _iobuf_cached = 0;
+    DeleteCriticalSection(&_iobuf_lock);
+    return SUCC;
+}
+
+char *iobuf_get()
+{
+    iobuf_free_t *b = NULL;
+
+    if (_iobuf_cached)
+        return _iobuf_cache[--_iobuf_cached];
+
+    EnterCriticalSection(&_iobuf_lock);
+    if (!_iobuf_free)
+        iobuf_grow();
+    if ((b = _iobuf_free))
+        _iobuf_free = b->next;
+    LeaveCriticalSection(&_iobuf_lock);
+    if (!b)
+        log_error("{%s:%d} no free buffer, %u slabs in use", __FUNCTION__, __LINE__, _iobuf_nslabs);
+    return (char*)b;
+}
+
+void iobuf_put(char *buf)
+{
+    iobuf_free_t *b = (iobuf_free_t*)buf;
+
+    if (!buf)
+        return;
+    if (_iobuf_cached < IOBUF_THREAD_CACHE)
+    {
+        _iobuf_cache[_iobuf_cached++] = buf;
+        return;
+    }
+    EnterCriticalSection(&_iobuf_lock);
+    b->next = _iobuf_free;
+    _iobuf_free = b;
+    LeaveCriticalSection(&_iobuf_lock);
+}
+
+static int iobuf_grow()
+{
+    iobuf_free_t *b = NULL;
+    char *slab = NULL;
+    uint32_t i;
+
+    if (_iobuf_nslabs == IOBUF_MAX_SLABS)
+        return FULL;
+
+    // committed up front, pages are reused and never given back while running
+    if (IOBUF_LARGE_PAGES)
+        slab = (char*)VirtualAlloc(NULL, _iobuf_slab, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    if (!slab)
+        slab = (char*)VirtualAlloc(NULL, _iobuf_slab, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (!slab)
+    {
+        log_error("{%s:%d} VirtualAlloc failed. GetLastError=%d", __FUNCTION__, __LINE__, GetLastError());
+        return FAIL;
+    }
+    _iobuf_slabs[_iobuf_nslabs++] = slab;
+    for (i=_iobuf_slab/IOBUF_SIZE; i>0; i--)
+    {
+        b = (iobuf_free_t*)(slab + (i - 1) * IOBUF_SIZE);
+        b->next = _iobuf_free;
+        _iobuf_free = b;
+    }
+    return SUCC;
+}
\ No newline at end of file
@@ -0,0 +1,15 @@
+#ifndef __IOBUF_H__
+#define __IOBUF_H__
+
+#define IOBUF_SIZE              (64 * 1024)         // bytes of one buffer, page aligned
+#define IOBUF_SLAB              (2 * 1024 * 1024)   // buffers are carved from slabs of this size
+#define IOBUF_MAX_SLABS         32                  // upper bound of the pool
+#define IOBUF_THREAD_CACHE      4                   // buffers kept by a thread without locking
+#define IOBUF_LARGE_PAGES       0                   // MEM_LARGE_PAGES slabs, needs SeLockMemoryPrivilege
+
+ret_code_t iobuf_init();
+ret_code_t iobuf_uninit();
+char      *iobuf_get();
+void       iobuf_put(char *buf);
+
+#endif
\ No newline at end of file
@@ -1,108 +1,367 @@
 ﻿#include "httpd.h"
 
 
-static void log_print(log_level_t lv, const char *msg);
+#define LOG_PREFIX  7       // "[INFO] "
+#define LOG_MASK    (LOG_RING_SIZE - 1)
+
+// lines of one thread, written by it and read by the writer thread without locking
+typedef struct log_ring_t log_ring_t;
+struct log_ring_t
+{
+    log_ring_t             *next;
+    volatile uint32_t       head;       // end of the published bytes, owner thread only
+    volatile uint32_t       tail;       // end of the written bytes, writer thread only
+    volatile uint32_t       dropped;    // lines lost to a full ring
+    uint32_t                reported;   // dropped lines already logged by the writer thread
+    char                    data[LOG_RING_SIZE];
+};
+
+static const char *_log_levels[] = { "[DEBU] ", "[INFO] ", "[WARN] ", "[ERRO] " };
+
+CRITICAL_SECTION    _log_lock;          // guards the ring list
+log_ring_t         *_log_rings      = NULL;
+HANDLE              _log_thread     = NULL;
+HANDLE              _log_wake       = NULL;
+HANDLE              _log_file       = INVALID_HANDLE_VALUE;
+char                _log_path[MAX_PATH] = {0};
+char                _log_batch[LOG_BATCH];
+uint8_t             _log_level      = LOG_LEVEL;
+volatile uint8_t    _log_stop       = 0;
+uint8_t             _log_running    = 0;
+__declspec(thread) log_ring_t *_log_ring = NULL;
+
+static void log_print(char *line, int ret);
+static int  log_format(char *buf, int size, const char *fmt, va_list args);
+static char *log_number(char *p, uint64_t value);
+static log_ring_t *log_ring();
+static void log_drain();
+static void log_flush(const char *buf, uint32_t size);
+static void log_write_sync(const char *line, uint32_t len);
 static const char* log_file_name();
+static DWORD WINAPI log_proc(LPVOID param);
 
-void log_debug(const char *fmt, ...)
+ret_code_t log_init()
 {
-    char buffer[BUFFER_UNIT] = { 0 };
+    InitializeCriticalSection(&_log_lock);
+    _log_stop = 0;
+    _log_wake = CreateEventA(NULL, FALSE, FALSE, NULL);
+    _log_thread = _log_wake ? CreateThread(NULL, 0, log_proc, NULL, 0, NULL) : NULL;
+    if (!_log_thread)
+    {
+        // lines keep being written synchronously
+        if (_log_wake)
+            CloseHandle(_log_wake);
+        _log_wake = NULL;
+        DeleteCriticalSection(&_log_lock);
+        log_error("{%s:%d} create log thread fail. GetLastError=%d", __FUNCTION__, __LINE__, GetLastError());
+        return FAIL;
+    }
+    _log_running = 1;
+    return SUCC;
+}
+
+ret_code_t log_uninit()
+{
+    log_ring_t *r = NULL;
+
+    if (!_log_running)
+        return SUCC;
+
+    // every other logging thread is stopped by now, the writer drains what is left
+    _log_running = 0;
+    _log_stop = 1;
+    SetEvent(_log_wake);
+    WaitForSingleObject(_log_thread, INFINITE);
+    CloseHandle(_log_thread);
+    CloseHandle(_log_wake);
+    _log_thread = NULL;
+    _log_wake = NULL;
+    while ((r = _log_rings))
+    {
+        _log_rings = r->next;
+        free(r);
+    }
+    _log_ring = NULL;
+    if (_log_file != INVALID_HANDLE_VALUE)
+        CloseHandle(_log_file);
+    _log_file = INVALID_HANDLE_VALUE;
+    _log_path[0] = 0;
+    DeleteCriticalSection(&_log_lock);
+    return SUCC;
+}
+
+void log_set_level(log_level_t lv)
+{
+    _log_level = lv > LOG_LEVEL ? lv : LOG_LEVEL;
+}
+
+void log_write(log_level_t lv, const char *fmt, ...)
+{
+    char line[LOG_LINE_MAX];
     va_list args;
+    int ret;
 
-    if (LOG_DEBU < LOG_LEVEL)
-        return;
-    
+    memcpy(line, _log_levels[lv], LOG_PREFIX);
     va_start(args, fmt);
-    vsnprintf(buffer, sizeof(buffer) - 1, fmt, args);
+    ret = log_format(line + LOG_PREFIX, LOG_LINE_MAX - LOG_PREFIX - 1, fmt, args);
     va_end(args);
-
-    log_print(LOG_DEBU, buffer);
+    if (ret < 0)
+    {
+        // vs2010 has no va_copy, the list is started again
+        va_start(args, fmt);
+        ret = _vsnprintf(line + LOG_PREFIX, LOG_LINE_MAX - LOG_PREFIX - 1, fmt, args);
+        va_end(args);
+    }
+    log_print(line, ret);
 }
 
-void log_info(const char *fmt, ...)
+static void log_print(char *line, int ret)
 {
-    char buffer[BUFFER_UNIT] = { 0 };
-    va_list args;
+    log_ring_t *r = NULL;
+    uint32_t head, used, len, n;
+
+    // ret is the length formatted after the level, -1 or more than fits if truncated
+    if (ret < 0 || ret >= LOG_LINE_MAX - LOG_PREFIX - 1)
+        ret = LOG_LINE_MAX - LOG_PREFIX - 2;
+    len = LOG_PREFIX + ret;
+    line[len++] = '\n';
 
-    if (LOG_INFO < LOG_LEVEL)
+    r = _log_running ? log_ring() : NULL;
+    if (!r)
+    {
+        log_write_sync(line, len);
         return;
+    }
+    head = r->head;
+    used = head - r->tail;
+    if (LOG_RING_SIZE - used < len)
+    {
+        // never blocks the caller, the writer reports the loss
+        r->dropped++;
+        SetEvent(_log_wake);
+        return;
+    }
+    n = LOG_RING_SIZE - (head & LOG_MASK);
+    if (n > len)
+        n = len;
+    memcpy(r->data + (head & LOG_MASK), line, n);
+    memcpy(r->data, line + n, len - n);
+    MemoryBarrier();
+    r->head = head + len;
+    // the writer wakes on its own every LOG_FLUSH_MS, earlier once the ring is half full
+    if (used < LOG_RING_SIZE / 2 && used + len >= LOG_RING_SIZE / 2)
+        SetEvent(_log_wake);
+}
 
-    va_start(args, fmt);
-    vsnprintf(buffer, sizeof(buffer) - 1, fmt, args);
-    va_end(args);
+static int log_format(char *buf, int size, const char *fmt, va_list args)
+{
+    char *p = buf;
+    char *end = buf + size - 1;
+    char num[24];
+    const char *str = NULL;
+    const char *q = NULL;
+    int64_t value;
+    int longs;
 
-    log_print(LOG_INFO, buffer);
+    // %s %d %u %lld %llu and %% without flags or width, the conversions of the log lines.
+    // -1 for anything else, the caller formats with _vsnprintf then
+    for (; *fmt && p < end; fmt++)
+    {
+        if (*fmt != '%')
+        {
+            *p++ = *fmt;
+            continue;
+        }
+        fmt++;
+        for (longs = 0; *fmt == 'l'; fmt++)
+            longs++;
+        str = num;
+        switch (*fmt)
+        {
+        case '%':
+            num[0] = '%';
+            num[1] = 0;
+            break;
+        case 's':
+            str = va_arg(args, const char*);
+            if (!str)
+                str = "(null)";
+            break;
+        case 'd':
+            value = longs == 2 ? va_arg(args, int64_t) : longs ? va_arg(args, long) : va_arg(args, int);
+            if (value < 0)
+            {
+                num[0] = '-';
+                *log_number(num + 1, 0 - (uint64_t)value) = 0;
+            }
+            else
+                *log_number(num, (uint64_t)value) = 0;
+            break;
+        case 'u':
+            *log_number(num, longs == 2 ? va_arg(args, uint64_t) : longs ? va_arg(args, unsigned long) : va_arg(args, unsigned int)) = 0;
+            break;
+        default:
+            return -1;
+        }
+        for (q = str; *q && p < end; q++)
+            *p++ = *q;
+    }
+    *p = 0;
+    // a truncated line is reported as size, log_print cuts it
+    return *fmt ? size : (int)(p - buf);
 }
 
-void log_warn(const char *fmt, ...)
+static char *log_number(char *p, uint64_t value)
 {
-    char buffer[BUFFER_UNIT] = { 0 };
-    va_list args;
+    char digits[20];
+    int n = 0;
 
-    if (LOG_WARN < LOG_LEVEL)
-        return;
+    do
+    {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (n)
+        *p++ = digits[--n];
+    return p;
+}
 
-    va_start(args, fmt);
-    vsnprintf(buffer, sizeof(buffer) - 1, fmt, args);
-    va_end(args);
+int log_is_file(const char *path)
+{
+    size_t root_len = strlen(root_path());
+    const char *name = path + root_len;
+    int i;
 
-    log_print(LOG_WARN, buffer);
-    //ASSERT(false);
+    // <root>yyyy-mm-dd.log, see log_file_name
+    if (_strnicmp(path, root_path(), root_len) || strlen(name) != strlen("yyyy-mm-dd.log") || _stricmp(name + 10, ".log"))
+        return 0;
+    for (i = 0; i < 10; i++)
+    {
+        if (i == 4 || i == 7 ? name[i] != '-' : name[i] < '0' || name[i] > '9')
+            return 0;
+    }
+    return 1;
 }
 
-void log_error(const char *fmt, ...)
+static log_ring_t *log_ring()
 {
-    char buffer[BUFFER_UNIT] = { 0 };
-    va_list args;
+    log_ring_t *r = NULL;
 
-    if (LOG_ERRO < LOG_LEVEL)
-        return;
+    if (_log_ring)
+        return _log_ring;
 
-    va_start(args, fmt);
-    vsnprintf(buffer, sizeof(buffer) - 1, fmt, args);
-    va_end(args);
+    // first line of this thread. nothing is logged here, the caller falls back to a direct write
+    r = (log_ring_t*)malloc(sizeof(log_ring_t));
+    if (!r)
+        return NULL;
+    r->head = 0;
+    r->tail = 0;
+    r->dropped = 0;
+    r->reported = 0;
+    EnterCriticalSection(&_log_lock);
+    r->next = _log_rings;
+    _log_rings = r;
+    LeaveCriticalSection(&_log_lock);
+    _log_ring = r;
+    return r;
+}
 
-    log_print(LOG_ERRO, buffer);
-    //ASSERT(false);
+static void log_drain()
+{
+    log_ring_t *r = NULL;
+    uint32_t size = 0;
+    uint32_t head, tail, dropped, n;
+
+    // rings are only added at the front, the rest of the list never changes
+    EnterCriticalSection(&_log_lock);
+    r = _log_rings;
+    LeaveCriticalSection(&_log_lock);
+
+    for (; r; r = r->next)
+    {
+        dropped = r->dropped;
+        if (dropped != r->reported)
+        {
+            if (size + 64 > LOG_BATCH)
+            {
+                log_flush(_log_batch, size);
+                size = 0;
+            }
+            size += sprintf(_log_batch + size, "%s%u log lines dropped\n", _log_levels[LOG_WARN], dropped - r->reported);
+            r->reported = dropped;
+        }
+        head = r->head;
+        MemoryBarrier();
+        for (tail = r->tail; tail != head; tail += n)
+        {
+            n = LOG_RING_SIZE - (tail & LOG_MASK);
+            if (n > head - tail)
+                n = head - tail;
+            if (n > LOG_BATCH - size)
+                n = LOG_BATCH - size;
+            memcpy(_log_batch + size, r->data + (tail & LOG_MASK), n);
+            size += n;
+            if (size == LOG_BATCH)
+            {
+                log_flush(_log_batch, size);
+                size = 0;
+            }
+        }
+        MemoryBarrier();
+        r->tail = tail;
+    }
+    if (size)
+        log_flush(_log_batch, size);
 }
 
-static void log_print(log_level_t lv, const char *msg)
+static void log_flush(const char *buf, uint32_t size)
 {
-    const char *str = NULL;
     const char *file_name = NULL;
-    FILE* fp = NULL;
+    DWORD written;
 
-    switch (lv)
+    if (SAVE_FILE)
     {
-    case LOG_DEBU:
-        str = "[DEBU]";
-        break;
-    case LOG_INFO:
-        str = "[INFO]";
-        break;
-    case LOG_WARN:
-        str = "[WARN]";
-        break;
-    case LOG_ERRO:
-        str = "[ERRO]";
-        break;
+        // one handle for the day, a new file after midnight
+        file_name = log_file_name();
+        if (strcmp(file_name, _log_path))
+        {
+            if (_log_file != INVALID_HANDLE_VALUE)
+                CloseHandle(_log_file);
+            _log_file = CreateFileA(file_name, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+            strcpy(_log_path, file_name);
+        }
+        if (_log_file != INVALID_HANDLE_VALUE)
+            WriteFile(_log_file, buf, size, &written, NULL);
     }
+    fwrite(buf, 1, size, stdout);
+}
 
+static void log_write_sync(const char *line, uint32_t len)
+{
+    FILE* fp = NULL;
+
+    // before log_init and after log_uninit
     if (SAVE_FILE)
     {
-        // write to file
-        file_name = log_file_name();
-        fp = fopen(file_name, "ab");
+        fp = fopen(log_file_name(), "ab");
         if (fp)
         {
-            fwrite(str, 1, strlen(str), fp);
-            fwrite(" ", 1, 1, fp);
-            fwrite(msg, 1, strlen(msg), fp);
-            fwrite("\n", 1, 1, fp);
+            fwrite(line, 1, len, fp);
             fclose(fp);
         }
     }
-    printf("%s %s\n", str, msg);
+    fwrite(line, 1, len, stdout);
+}
+
+static DWORD WINAPI log_proc(LPVOID param)
+{
+    while (!_log_stop)
+    {
+        WaitForSingleObject(_log_wake, LOG_FLUSH_MS);
+        log_drain();
+    }
+    log_drain();
+    return 0;
 }
 
 static const char* log_file_name()
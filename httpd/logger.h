@@ -10,12 +10,26 @@ typedef enum
     LOG_ERRO
 } log_level_t;
 
-#define LOG_LEVEL   LOG_INFO
+#define LOG_LEVEL   LOG_INFO    // lower levels are compiled out, arguments included
 #define SAVE_FILE   1
+#define LOG_RING_SIZE   (256 * 1024)    // bytes of lines queued per thread, power of two
+#define LOG_LINE_MAX    BUFFER_UNIT
+#define LOG_BATCH       (64 * 1024)     // bytes handed to one WriteFile
+#define LOG_FLUSH_MS    50              // longest time a line waits for the writer thread
 
-void log_debug(const char *fmt, ...);
-void log_info(const char *fmt, ...);
-void log_warn(const char *fmt, ...);
-void log_error(const char *fmt, ...);
+// arguments are only evaluated for a line that is written
+#define LOG_ENABLED(lv)     ((lv) >= LOG_LEVEL && (lv) >= _log_level)
+#define log_debug(...)      do { if (LOG_ENABLED(LOG_DEBU)) log_write(LOG_DEBU, __VA_ARGS__); } while (0)
+#define log_info(...)       do { if (LOG_ENABLED(LOG_INFO)) log_write(LOG_INFO, __VA_ARGS__); } while (0)
+#define log_warn(...)       do { if (LOG_ENABLED(LOG_WARN)) log_write(LOG_WARN, __VA_ARGS__); } while (0)
+#define log_error(...)      do { if (LOG_ENABLED(LOG_ERRO)) log_write(LOG_ERRO, __VA_ARGS__); } while (0)
+
+extern uint8_t _log_level;  // runtime level, never below LOG_LEVEL
+
+ret_code_t log_init();
+ret_code_t log_uninit();
+void log_set_level(log_level_t lv);
+void log_write(log_level_t lv, const char *fmt, ...);
+int  log_is_file(const char *path);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,255 @@
+#include "httpd.h"
+#include <errno.h>
+
+
+typedef struct
+{
+    char                   *ext;        // lowercase, NULL for an empty slot
+    char                   *type;       // same allocation as ext
+} mime_slot_t;
+
+mime_slot_t *_mime_slots = NULL;
+uint32_t     _mime_cap   = 0;       // power of two
+uint32_t     _mime_size  = 0;
+
+static const char *_mime_defaults[][2] = {
+    { "html",   "text/html"                 },
+    { "htm",    "text/html"                 },
+    { "css",    "text/css"                  },
+    { "txt",    "text/plain"                },
+    { "log",    "text/plain"                },
+    { "md",     "text/markdown"             },
+    { "csv",    "text/csv"                  },
+    { "xml",    "text/xml"                  },
+    { "c",      "text/plain"                },
+    { "h",      "text/plain"                },
+    { "cpp",    "text/plain"                },
+    { "js",     "text/javascript"           },
+    { "mjs",    "text/javascript"           },
+    { "json",   "application/json"          },
+    { "wasm",   "application/wasm"          },
+    { "pdf",    "application/pdf"           },
+    { "zip",    "application/zip"           },
+    { "gz",     "application/gzip"          },
+    { "tgz",    "application/gzip"          },
+    { "tar",    "application/x-tar"         },
+    { "7z",     "application/x-7z-compressed" },
+    { "rar",    "application/vnd.rar"       },
+    { "xz",     "application/x-xz"          },
+    { "bz2",    "application/x-bzip2"       },
+    { "iso",    "application/x-iso9660-image" },
+    { "exe",    "application/vnd.microsoft.portable-executable" },
+    { "msi",    "application/x-msdownload"  },
+    { "jar",    "application/java-archive"  },
+    { "apk",    "application/vnd.android.package-archive" },
+    { "png",    "image/png"                 },
+    { "jpg",    "image/jpeg"                },
+    { "jpeg",   "image/jpeg"                },
+    { "jpe",    "image/jpeg"                },
+    { "gif",    "image/gif"                 },
+    { "bmp",    "image/bmp"                 },
+    { "webp",   "image/webp"                },
+    { "svg",    "image/svg+xml"             },
+    { "ico",    "image/x-icon"              },
+    { "tif",    "image/tiff"                },
+    { "tiff",   "image/tiff"                },
+    { "doc",    "application/msword"        },
+    { "docx",   "application/vnd.openxmlformats-officedocument.wordprocessingml.document" },
+    { "ppt",    "application/vnd.ms-powerpoint" },
+    { "pptx",   "application/vnd.openxmlformats-officedocument.presentationml.presentation" },
+    { "xls",    "application/vnd.ms-excel"  },
+    { "xlsx",   "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet" },
+    { "mp4",    "video/mp4"                 },
+    { "webm",   "video/webm"                },
+    { "mkv",    "video/x-matroska"          },
+    { "avi",    "video/x-msvideo"           },
+    { "mov",    "video/quicktime"           },
+    { "mp3",    "audio/mpeg"                },
+    { "wav",    "audio/wav"                 },
+    { "ogg",    "audio/ogg"                 },
+    { "flac",   "audio/flac"                },
+    { "woff",   "font/woff"                 },
+    { "woff2",  "font/woff2"                },
+    { "ttf",    "font/ttf"                  }
+};
+
+static uint32_t mime_hash(const char *ext);
+static int  mime_lower(const char *ext, char *buf);
+static int  mime_add(const char *ext, const char *type);
+static int  mime_grow();
+static int  mime_load(const char *file_name);
+
+ret_code_t mime_init(const char *file_name)
+{
+    uint32_t i;
+
+    for (i=0; i<sizeof(_mime_defaults)/sizeof(_mime_defaults[0]); i++)
+    {
+        if (SUCC != mime_add(_mime_defaults[i][0], _mime_defaults[i][1]))
+            return FAIL;
+    }
+    if (file_name && file_exist((char*)file_name))
+    {
+        // entries of the file replace the defaults
+        mime_load(file_name);
+    }
+    log_info("{%s:%d} %u mime types loaded", __FUNCTION__, __LINE__, _mime_size);
+    return SUCC;
+}
+
+ret_code_t mime_uninit()
+{
+    uint32_t i;
+
+    for (i=0; i<_mime_cap; i++)
+    {
+        free(_mime_slots[i].ext);
+    }
+    free(_mime_slots);
+    _mime_slots = NULL;
+    _mime_cap = 0;
+    _mime_size = 0;
+    return SUCC;
+}
+
+const char *mime_type(const char *file_name)
+{
+    char ext[MIME_EXT_MAX_LEN];
+    const char *p = NULL;
+    uint32_t i;
+
+    if (!_mime_cap || !(p = strrchr(file_name, '.')) || strchr(p, '/'))
+        return MIME_DEFAULT_TYPE;
+    if (!mime_lower(p + 1, ext))
+        return MIME_DEFAULT_TYPE;
+
+    // linear probing, the table is never full
+    for (i = mime_hash(ext) & (_mime_cap - 1); _mime_slots[i].ext; i = (i + 1) & (_mime_cap - 1))
+    {
+        if (0 == strcmp(_mime_slots[i].ext, ext))
+            return _mime_slots[i].type;
+    }
+    return MIME_DEFAULT_TYPE;
+}
+
+static uint32_t mime_hash(const char *ext)
+{
+    uint32_t h = 2166136261u;   // FNV-1a
+
+    while (*ext)
+    {
+        h ^= (uint8_t)*ext++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int mime_lower(const char *ext, char *buf)
+{
+    int i;
+
+    for (i=0; ext[i]; i++)
+    {
+        if (i >= MIME_EXT_MAX_LEN - 1)
+            return 0;
+        buf[i] = (ext[i] >= 'A' && ext[i] <= 'Z') ? ext[i] - 'A' + 'a' : ext[i];
+    }
+    buf[i] = 0;
+    return i;
+}
+
+static int mime_add(const char *ext, const char *type)
+{
+    char key[MIME_EXT_MAX_LEN];
+    char *block = NULL;
+    int ext_len, type_len;
+    uint32_t i;
+
+    ext_len = mime_lower(ext, key);
+    if (!ext_len)
+        return PARA;
+    if ((_mime_size + 1) * 10 > _mime_cap * 7 && SUCC != mime_grow())
+        return FAIL;
+
+    type_len = strlen(type);
+    block = (char*)malloc(ext_len + 1 + type_len + 1);
+    if (!block)
+    {
+        log_error("{%s:%d} malloc failed", __FUNCTION__, __LINE__);
+        return FAIL;
+    }
+    memcpy(block, key, ext_len + 1);
+    memcpy(block + ext_len + 1, type, type_len + 1);
+
+    for (i = mime_hash(key) & (_mime_cap - 1); _mime_slots[i].ext; i = (i + 1) & (_mime_cap - 1))
+    {
+        if (0 == strcmp(_mime_slots[i].ext, key))
+        {
+            free(_mime_slots[i].ext);
+            _mime_size--;
+            break;
+        }
+    }
+    _mime_slots[i].ext = block;
+    _mime_slots[i].type = block + ext_len + 1;
+    _mime_size++;
+    return SUCC;
+}
+
+static int mime_grow()
+{
+    mime_slot_t *slots = _mime_slots;
+    uint32_t cap = _mime_cap;
+    uint32_t i, j;
+
+    _mime_cap = cap ? cap * 2 : 128;
+    _mime_slots = (mime_slot_t*)malloc(_mime_cap * sizeof(mime_slot_t));
+    if (!_mime_slots)
+    {
+        log_error("{%s:%d} malloc failed", __FUNCTION__, __LINE__);
+        _mime_slots = slots;
+        _mime_cap = cap;
+        return FAIL;
+    }
+    memset(_mime_slots, 0, _mime_cap * sizeof(mime_slot_t));
+    for (i=0; i<cap; i++)
+    {
+        if (!slots[i].ext)
+            continue;
+        for (j = mime_hash(slots[i].ext) & (_mime_cap - 1); _mime_slots[j].ext; j = (j + 1) & (_mime_cap - 1));
+        _mime_slots[j] = slots[i];
+    }
+    free(slots);
+    return SUCC;
+}
+
+static int mime_load(const char *file_name)
+{
+    const char *delim = " \t\r\n;";
+    char line[BUFFER_UNIT];
+    char *type = NULL;
+    char *ext = NULL;
+    FILE *fp = NULL;
+
+    fp = fopen(file_name, "rb");
+    if (!fp)
+    {
+        log_error("{%s:%d} open [%s] failed, errno=%d", __FUNCTION__, __LINE__, file_name, errno);
+        return FAIL;
+    }
+    // "type ext ext ...", '#' comments, nginx "types { ... }" wrapper is skipped
+    while (fgets(line, sizeof(line), fp))
+    {
+        if ((type = strchr(line, '#')))
+            *type = 0;
+        type = strtok(line, delim);
+        if (!type || !strchr(type, '/'))
+            continue;
+        while ((ext = strtok(NULL, delim)))
+        {
+            mime_add(ext, type);
+        }
+    }
+    fclose(fp);
+    return SUCC;
+}
\ No newline at end of file
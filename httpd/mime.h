@@ -0,0 +1,12 @@
+#ifndef __MIME_H__
+#define __MIME_H__
+
+#define MIME_TYPES_FILE     "mime.types"    // optional, same format as nginx/apache mime.types
+#define MIME_DEFAULT_TYPE   "application/octet-stream"
+#define MIME_EXT_MAX_LEN    32
+
+ret_code_t  mime_init(const char *file_name);
+ret_code_t  mime_uninit();
+const char *mime_type(const char *file_name);
+
+#endif
\ No newline at end of file
@@ -128,6 +128,26 @@ ret_code_t network_read(SOCKET fd, char *buf, int32_t size)
     return FAIL;
 }
 
+ret_code_t network_read_some(SOCKET fd, char *buf, uint32_t size, uint32_t *read)
+{
+    int ret;
+
+    // a single recv, returns whatever the socket already holds
+    ret = recv(fd, buf, size, 0);
+    if (ret == SOCKET_ERROR)
+    {
+        log_error("{%s:%d} recv fail. socket=%d WSAGetLastError=%d", __FUNCTION__, __LINE__, fd, WSAGetLastError());
+        return DISC;
+    }
+    else if (ret == 0) // the connection has been gracefully closed
+    {
+        log_info("{%s:%d} Disconnect. socket=%d", __FUNCTION__, __LINE__, fd);
+        return DISC;
+    }
+    *read = ret;
+    return SUCC;
+}
+
 ret_code_t network_write(SOCKET fd, void *buf, uint32_t size)
 {
     if (size != send(fd, buf, size, 0))
@@ -136,5 +156,56 @@ ret_code_t network_write(SOCKET fd, void *buf, uint32_t size)
         return FAIL;
     }
 
+    return SUCC;
+}
+
+ret_code_t network_write_some(SOCKET fd, char *buf, uint32_t size, uint32_t *written)
+{
+    ret_code_t result = SUCC;
+    u_long mode = 1;
+    int ret;
+
+    // as much as the socket takes without waiting, it is blocking again on return
+    *written = 0;
+    if (SOCKET_ERROR == ioctlsocket(fd, FIONBIO, &mode))
+    {
+        log_error("{%s:%d} ioctlsocket fail. socket=%d, WSAGetLastError=%d", __FUNCTION__, __LINE__, fd, WSAGetLastError());
+        return FAIL;
+    }
+    while (*written < size)
+    {
+        ret = send(fd, buf + *written, size - *written, 0);
+        if (ret == SOCKET_ERROR)
+        {
+            if (WSAGetLastError() != WSAEWOULDBLOCK)
+            {
+                log_error("{%s:%d} send fail. socket=%d, WSAGetLastError=%d", __FUNCTION__, __LINE__, fd, WSAGetLastError());
+                result = FAIL;
+            }
+            break;
+        }
+        *written += ret;
+    }
+    mode = 0;
+    ioctlsocket(fd, FIONBIO, &mode);
+    return result;
+}
+
+ret_code_t network_writev(SOCKET fd, WSABUF *bufs, uint32_t count)
+{
+    DWORD size = 0;
+    DWORD sent = 0;
+    uint32_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        size += bufs[i].len;
+    }
+    if (SOCKET_ERROR == WSASend(fd, bufs, count, &sent, 0, NULL, NULL) || sent != size)
+    {
+        log_error("{%s:%d} send fail. socket=%d, WSAGetLastError=%d", __FUNCTION__, __LINE__, fd, WSAGetLastError());
+        return FAIL;
+    }
+
     return SUCC;
 }
\ No newline at end of file
@@ -7,6 +7,9 @@ ret_code_t network_unint();
 ret_code_t network_listen(uint16_t *port, SOCKET *fd);
 ret_code_t network_accept(SOCKET sfd, struct in_addr* addr, SOCKET *cfd);
 ret_code_t network_read(SOCKET fd, char *buf, int32_t size);
+ret_code_t network_read_some(SOCKET fd, char *buf, uint32_t size, uint32_t *read);
 ret_code_t network_write(SOCKET fd, void *buf, uint32_t size);
+ret_code_t network_write_some(SOCKET fd, char *buf, uint32_t size, uint32_t *written);
+ret_code_t network_writev(SOCKET fd, WSABUF *bufs, uint32_t count);
 
 #endif
\ No newline at end of file
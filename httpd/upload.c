@@ -0,0 +1,1003 @@
+#include "httpd.h"
+#include <errno.h>
+#include <ntsecapi.h>
+#pragma comment(lib, "Advapi32.lib")
+
+
+#define FILE_RENAME_INFO_EX                 ((FILE_INFO_BY_HANDLE_CLASS)22)     // windows 10 1709
+#define FILE_RENAME_FLAG_REPLACE_IF_EXISTS  0x00000001
+#define FILE_RENAME_FLAG_POSIX_SEMANTICS    0x00000002
+
+typedef struct upload_block_t upload_block_t;
+struct upload_block_t
+{
+    upload_block_t         *next;
+    upload_t               *u;
+    char                   *data;       // UPLOAD_ALIGN aligned, UPLOAD_BLOCK_SIZE bytes
+    uint64_t                offset;     // file offset of data
+    uint32_t                size;
+};
+
+struct upload_t
+{
+    HANDLE                  handle;
+    uint64_t                offset;     // file offset of the block being filled
+    uint64_t                reserved;   // preallocated size
+    upload_block_t         *block;      // being filled by the loop thread
+    upload_block_t          closer;     // queued after the last block, the writer thread closes the file
+    hash_t                 *hash;       // UPLOAD_CREATE only, updated by the writer thread
+    hash_digest_t           digest;     // final hash, set by the writer thread
+    uint32_t                pending;    // blocks queued or being written, guarded by _upload_lock
+    DWORD                   error;      // GetLastError of the first failed write, guarded by _upload_lock
+    uint8_t                 cancel;     // drop queued blocks
+    uint8_t                 direct;     // opened with FILE_FLAG_NO_BUFFERING
+    uint8_t                 mode;       // upload_mode_t
+    uint8_t                 closing;    // closer queued, loop thread only
+    uint8_t                 closed;     // file closed by the writer thread, guarded by _upload_lock
+    uint8_t                 detached;   // nobody waits for the result, freed by the writer thread
+};
+
+// FILE_RENAME_INFO with the flags of FileRenameInfoEx, in the layout of the system headers
+#pragma pack(push, 8)
+typedef struct
+{
+    DWORD                   flags;
+    HANDLE                  root;
+    DWORD                   length;     // bytes of name
+    WCHAR                   name[MAX_PATH];
+} upload_rename_info_t;
+#pragma pack(pop)
+
+typedef struct
+{
+    uint64_t                first;
+    uint64_t                end;        // exclusive
+} upload_range_t;
+
+typedef struct
+{
+    char                   *target;     // NULL for a free slot
+    uint64_t                total;
+    uint32_t                writers;    // connections writing ranges now
+    upload_range_t         *ranges;     // received, sorted and merged
+    uint32_t                count;
+    time_t                  active;     // last range begun or ended
+} upload_range_file_t;
+
+// blocks are written in order by a single writer thread
+CRITICAL_SECTION    _upload_lock;
+CONDITION_VARIABLE  _upload_queued;
+upload_block_t     *_upload_head    = NULL;
+upload_block_t     *_upload_tail    = NULL;
+upload_block_t     *_upload_free    = NULL;
+uint32_t            _upload_nfree   = 0;
+uint8_t             _upload_stop    = 0;
+HANDLE              _upload_thread  = NULL;
+
+// range uploads in progress, only used by the loop thread
+upload_range_file_t _upload_ranges[UPLOAD_RANGE_FILES];
+
+static upload_block_t *alloc_block(upload_t *u);
+static void free_block(upload_block_t *b);
+static void queue_block(upload_block_t *b);
+static DWORD write_block(upload_block_t *b);
+static void upload_close_begin(upload_t *u);
+static void upload_close_file(upload_t *u);
+static void upload_release(upload_t *u, int cancel);
+static ret_code_t upload_error(DWORD error);
+static int  blob_path(char *buf, const uint8_t *sha256);
+static int  blob_verified(const char *blob, const uint8_t *sha256, uint64_t *size);
+static void blob_sweep();
+static int  session_path(char *buf, const char *id, const char *ext);
+static ret_code_t session_read_info(const char *info, uint64_t *length, char *target);
+static ret_code_t file_size(const char *path, uint64_t *size);
+static upload_range_file_t *range_file_find(const char *target);
+static upload_range_file_t *range_file_slot();
+static void range_file_free(upload_range_file_t *f);
+static DWORD WINAPI upload_proc(LPVOID param);
+
+ret_code_t upload_init()
+{
+    InitializeCriticalSection(&_upload_lock);
+    InitializeConditionVariable(&_upload_queued);
+    _upload_stop = 0;
+    if (UPLOAD_DEDUP)
+        blob_sweep();
+    _upload_thread = CreateThread(NULL, 0, upload_proc, NULL, 0, NULL);
+    if (!_upload_thread)
+    {
+        log_error("{%s:%d} create writer thread fail. GetLastError=%d", __FUNCTION__, __LINE__, GetLastError());
+        return FAIL;
+    }
+    return SUCC;
+}
+
+ret_code_t upload_uninit()
+{
+    upload_block_t *b = NULL;
+    uint32_t i;
+
+    if (_upload_thread)
+    {
+        EnterCriticalSection(&_upload_lock);
+        _upload_stop = 1;
+        WakeAllConditionVariable(&_upload_queued);
+        LeaveCriticalSection(&_upload_lock);
+        WaitForSingleObject(_upload_thread, INFINITE);
+        CloseHandle(_upload_thread);
+        _upload_thread = NULL;
+    }
+    while ((b = _upload_free))
+    {
+        _upload_free = b->next;
+        _aligned_free(b->data);
+        free(b);
+    }
+    _upload_nfree = 0;
+    DeleteCriticalSection(&_upload_lock);
+    for (i=0; i<UPLOAD_RANGE_FILES; i++)
+    {
+        range_file_free(_upload_ranges + i);
+    }
+    return SUCC;
+}
+
+ret_code_t upload_open(const char *path, upload_mode_t mode, uint64_t offset, uint64_t size, upload_t **u)
+{
+    FILE_ALLOCATION_INFO alloc;
+    DWORD flags = FILE_FLAG_SEQUENTIAL_SCAN;
+    DWORD share = FILE_SHARE_READ | FILE_SHARE_DELETE;
+    DWORD disposition = CREATE_ALWAYS;
+    DWORD error;
+
+    *u = (upload_t*)malloc(sizeof(upload_t));
+    if (!*u)
+    {
+        log_error("{%s:%d} malloc failed", __FUNCTION__, __LINE__);
+        return FAIL;
+    }
+    memset(*u, 0, sizeof(upload_t));
+    // unbuffered writes must start on a sector boundary, and a padded tail
+    // would overwrite the next range of a shared file
+    (*u)->direct = UPLOAD_DIRECT_IO && mode != UPLOAD_SHARED && !(offset % UPLOAD_ALIGN);
+    if ((*u)->direct)
+        flags |= FILE_FLAG_NO_BUFFERING;
+    if (mode == UPLOAD_APPEND)
+        disposition = OPEN_EXISTING;
+    if (mode == UPLOAD_SHARED)
+    {
+        disposition = OPEN_ALWAYS;
+        share |= FILE_SHARE_WRITE;
+    }
+    (*u)->mode = (uint8_t)mode;
+    (*u)->offset = offset;
+    if (mode == UPLOAD_CREATE)
+    {
+        // the blocks are hashed as they are written, the file is never read back
+        (*u)->hash = (hash_t*)malloc(sizeof(hash_t));
+        if (!(*u)->hash)
+        {
+            log_error("{%s:%d} malloc failed", __FUNCTION__, __LINE__);
+            free(*u);
+            *u = NULL;
+            return FAIL;
+        }
+        hash_init((*u)->hash);
+    }
+    if (!path)
+    {
+        // the content is already stored, the bytes are only hashed to prove it
+        (*u)->handle = INVALID_HANDLE_VALUE;
+        return SUCC;
+    }
+    (*u)->handle = CreateFileA(path, GENERIC_WRITE, share, NULL, disposition,
+        FILE_ATTRIBUTE_NORMAL | flags, NULL);
+    if ((*u)->handle == INVALID_HANDLE_VALUE)
+    {
+        error = GetLastError();
+        log_error("{%s:%d} open [%s] failed. GetLastError=%d", __FUNCTION__, __LINE__, path, error);
+        free((*u)->hash);
+        free(*u);
+        *u = NULL;
+        return error == ERROR_SHARING_VIOLATION ? EXIS : upload_error(error);
+    }
+
+    // reserve the expected size in one go, the file size itself is not changed
+    if (size)
+    {
+        alloc.AllocationSize.QuadPart = size;
+        if (SetFileInformationByHandle((*u)->handle, FileAllocationInfo, &alloc, sizeof(alloc)))
+        {
+            (*u)->reserved = size;
+        }
+        else
+        {
+            error = GetLastError();
+            log_warn("{%s:%d} preallocate [%s] %llu bytes failed. GetLastError=%d", __FUNCTION__, __LINE__, path, size, error);
+            if (FULL == upload_error(error))
+            {
+                CloseHandle((*u)->handle);
+                DeleteFileA(path);
+                free((*u)->hash);
+                free(*u);
+                *u = NULL;
+                return FULL;
+            }
+        }
+    }
+    return SUCC;
+}
+
+ret_code_t upload_write(upload_t *u, const char *data, uint32_t size)
+{
+    uint32_t len;
+    DWORD error;
+
+    EnterCriticalSection(&_upload_lock);
+    error = u->error;
+    LeaveCriticalSection(&_upload_lock);
+    if (error)
+        return upload_error(error);
+    while (size)
+    {
+        if (!u->block && !(u->block = alloc_block(u)))
+            return FAIL;
+        len = UPLOAD_BLOCK_SIZE - u->block->size;
+        if (len > size)
+            len = size;
+        memcpy(u->block->data + u->block->size, data, len);
+        u->block->size += len;
+        data += len;
+        size -= len;
+        if (u->block->size == UPLOAD_BLOCK_SIZE)
+        {
+            u->offset += UPLOAD_BLOCK_SIZE;
+            queue_block(u->block);
+            u->block = NULL;
+        }
+    }
+    return SUCC;
+}
+
+int upload_busy(upload_t *u)
+{
+    int busy;
+
+    EnterCriticalSection(&_upload_lock);
+    busy = u->pending >= UPLOAD_QUEUE_BLOCKS;
+    LeaveCriticalSection(&_upload_lock);
+    return busy;
+}
+
+void upload_close(upload_t *u)
+{
+    // flushed and closed by the writer thread after the queued blocks,
+    // the loop polls upload_closed() meanwhile
+    upload_close_begin(u);
+}
+
+int upload_closed(upload_t *u)
+{
+    int closed;
+
+    EnterCriticalSection(&_upload_lock);
+    closed = u->closed;
+    LeaveCriticalSection(&_upload_lock);
+    return closed;
+}
+
+ret_code_t upload_result(upload_t *u, hash_digest_t *digest)
+{
+    ret_code_t ret = SUCC;
+
+    // only after upload_closed(), nothing else touches u then
+    if (u->error)
+    {
+        log_error("{%s:%d} write failed. GetLastError=%d", __FUNCTION__, __LINE__, u->error);
+        ret = upload_error(u->error);
+    }
+    if (digest)
+        memcpy(digest, &u->digest, sizeof(hash_digest_t));
+    free(u->hash);
+    free(u);
+    return ret;
+}
+
+void upload_detach(upload_t *u)
+{
+    // the received bytes are kept, the result is not needed
+    upload_release(u, 0);
+}
+
+void upload_abort(upload_t *u)
+{
+    upload_release(u, 1);
+}
+
+ret_code_t upload_commit(const char *temp, const char *target)
+{
+    upload_rename_info_t info;
+    wchar_t *name = NULL;
+    HANDLE handle;
+    BOOL done = FALSE;
+
+    // posix rename: the name points to the new file at once, readers that
+    // opened the old one keep reading it until they close it
+    handle = CreateFileA(temp, DELETE | SYNCHRONIZE | (UPLOAD_DURABILITY == UPLOAD_SYNC_FULL ? GENERIC_WRITE : 0),
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        log_error("{%s:%d} open [%s] failed. GetLastError=%d", __FUNCTION__, __LINE__, temp, GetLastError());
+        return FAIL;
+    }
+    name = ansi_to_unicode((char*)target);
+    if (name && wcslen(name) < MAX_PATH)
+    {
+        memset(&info, 0, sizeof(info));
+        info.flags = FILE_RENAME_FLAG_REPLACE_IF_EXISTS | FILE_RENAME_FLAG_POSIX_SEMANTICS;
+        info.length = (DWORD)(wcslen(name) * sizeof(WCHAR));
+        memcpy(info.name, name, info.length);
+        done = SetFileInformationByHandle(handle, FILE_RENAME_INFO_EX, &info, sizeof(info));
+        if (done && UPLOAD_DURABILITY == UPLOAD_SYNC_FULL)
+            FlushFileBuffers(handle);
+    }
+    free(name);
+    CloseHandle(handle);
+
+    // older systems: fails while the old file is open without FILE_SHARE_DELETE
+    if (!done && !MoveFileExA(temp, target, MOVEFILE_REPLACE_EXISTING
+        | (UPLOAD_DURABILITY == UPLOAD_SYNC_FULL ? MOVEFILE_WRITE_THROUGH : 0)))
+    {
+        log_error("{%s:%d} rename [%s] failed. GetLastError=%d", __FUNCTION__, __LINE__, target, GetLastError());
+        return FAIL;
+    }
+    return SUCC;
+}
+
+int upload_reserved(const char *path)
+{
+    char name[MAX_PATH] = {0};
+    char *p = NULL;
+    int len;
+
+    // first segment below the root, matched the way windows resolves it:
+    // any case, trailing dots and spaces dropped, short names expanded
+    for (len = 0; path[len] && path[len] != '/'; len++);
+    if (!len || len + strlen(root_path()) >= MAX_PATH)
+        return 0;
+    len = sprintf(name, "%s%.*s", root_path(), len, path);
+    while (name[len - 1] == '.' || name[len - 1] == ' ')
+        name[--len] = 0;
+    if (strchr(name + strlen(root_path()), '~') && GetLongPathNameA(name, name, MAX_PATH))
+    {
+        for (p = name + strlen(name); p > name && p[-1] != '/' && p[-1] != '\\'; p--);
+        return 0 == _stricmp(p, UPLOAD_SESSION_DIR) || 0 == _stricmp(p, UPLOAD_BLOB_DIR);
+    }
+    p = name + strlen(root_path());
+    return 0 == _stricmp(p, UPLOAD_SESSION_DIR) || 0 == _stricmp(p, UPLOAD_BLOB_DIR);
+}
+
+int upload_blob_exists(const uint8_t *sha256)
+{
+    char blob[MAX_PATH] = {0};
+    uint64_t size;
+
+    return UPLOAD_DEDUP && sha256 && blob_path(blob, sha256) && blob_verified(blob, sha256, &size);
+}
+
+ret_code_t upload_blob_store(const char *file, const hash_digest_t *digest)
+{
+    char blob[MAX_PATH] = {0};
+    char link[MAX_PATH + 8] = {0};
+    uint64_t size = 0;
+
+    if (!blob_path(blob, digest->sha256))
+        return FAIL;
+
+    // same content stored before: the new copy is replaced by a link to it
+    if (blob_verified(blob, digest->sha256, &size) && size == digest->size)
+    {
+        sprintf(link, "%s.blob", file);
+        if (CreateHardLinkA(link, blob, NULL))
+        {
+            if (SUCC == upload_commit(link, file))
+            {
+                log_info("{%s:%d} [%s] deduplicated", __FUNCTION__, __LINE__, file);
+                return EXIS;
+            }
+            DeleteFileA(link);
+        }
+        // 1023 links at most, then the file keeps a copy of its own, digest stream included
+        log_warn("{%s:%d} link [%s] failed. GetLastError=%d", __FUNCTION__, __LINE__, file, GetLastError());
+        if (!file_exist((char*)file) && !CopyFileA(blob, file, FALSE))
+        {
+            log_error("{%s:%d} copy [%s] failed. GetLastError=%d", __FUNCTION__, __LINE__, file, GetLastError());
+            return FAIL;
+        }
+        return SUCC;
+    }
+
+    // a blob the server did not hash itself is never linked to, it is replaced
+    if (file_exist(blob) && !DeleteFileA(blob))
+    {
+        log_warn("{%s:%d} remove [%s] failed. GetLastError=%d", __FUNCTION__, __LINE__, blob, GetLastError());
+        hash_save(file, digest);
+        return SUCC;
+    }
+    // new content becomes the blob, linked rather than copied. the digest
+    // stream is shared by every link and vouches for the content
+    if (SUCC != hash_save(file, digest))
+        return SUCC;
+    if (!CreateHardLinkA(blob, file, NULL))
+        log_warn("{%s:%d} link [%s] failed. GetLastError=%d", __FUNCTION__, __LINE__, blob, GetLastError());
+    return SUCC;
+}
+
+ret_code_t upload_session_create(const char *target, uint64_t length, char *id)
+{
+    char path[MAX_PATH] = {0};
+    uint8_t random[UPLOAD_SESSION_ID_LEN / 2];
+    FILE *fp = NULL;
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    int tries, i;
+
+    sprintf(path, "%s%s", root_path(), UPLOAD_SESSION_DIR);
+    if (!CreateDirectoryA(path, NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+    {
+        log_error("{%s:%d} create [%s] failed. GetLastError=%d", __FUNCTION__, __LINE__, path, GetLastError());
+        return FAIL;
+    }
+
+    // the id is all a client needs to write into a session, it must not be guessable
+    for (tries = 0; tries < 4 && handle == INVALID_HANDLE_VALUE; tries++)
+    {
+        if (!RtlGenRandom(random, sizeof(random)))
+        {
+            log_error("{%s:%d} RtlGenRandom failed. GetLastError=%d", __FUNCTION__, __LINE__, GetLastError());
+            return FAIL;
+        }
+        for (i = 0; i < (int)sizeof(random); i++)
+            sprintf(id + i * 2, "%02x", random[i]);
+        session_path(path, id, ".part");
+        handle = CreateFileA(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (handle == INVALID_HANDLE_VALUE && GetLastError() != ERROR_FILE_EXISTS)
+            break;
+    }
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        log_error("{%s:%d} create [%s] failed. GetLastError=%d", __FUNCTION__, __LINE__, path, GetLastError());
+        return upload_error(GetLastError());
+    }
+    CloseHandle(handle);
+
+    session_path(path, id, ".info");
+    fp = fopen(path, "wb");
+    if (!fp || fprintf(fp, "%llu\n%s\n", length, target) < 0 || fclose(fp))
+    {
+        log_error("{%s:%d} write [%s] failed. errno=%d", __FUNCTION__, __LINE__, path, errno);
+        upload_session_delete(id);
+        return FAIL;
+    }
+    log_info("{%s:%d} upload session %s created for [%s], %llu bytes", __FUNCTION__, __LINE__, id, target, length);
+    return SUCC;
+}
+
+ret_code_t upload_session_query(const char *id, uint64_t *offset, uint64_t *length, char *part)
+{
+    char info[MAX_PATH] = {0};
+    char target[MAX_PATH] = {0};
+
+    if (!session_path(info, id, ".info") || SUCC != session_read_info(info, length, target))
+        return NEXI;
+    session_path(part, id, ".part");
+    if (SUCC != file_size(part, offset))
+        return NEXI;
+    return SUCC;
+}
+
+ret_code_t upload_session_commit(const char *part, uint64_t *offset, uint64_t *length)
+{
+    char info[MAX_PATH] = {0};
+    char target[MAX_PATH] = {0};
+    int len;
+
+    // <id>.part -> <id>.info
+    len = strlen(part) - strlen(".part");
+    memcpy(info, part, len);
+    memcpy(info + len, ".info", sizeof(".info"));
+    if (SUCC != session_read_info(info, length, target) || SUCC != file_size(part, offset))
+        return NEXI;
+    if (*offset < *length)
+        return SUCC;
+
+    if (SUCC != upload_commit(part, target))
+        return FAIL;
+    DeleteFileA(info);
+    log_info("{%s:%d} upload [%s] complete", __FUNCTION__, __LINE__, target);
+    return SUCC;
+}
+
+ret_code_t upload_session_delete(const char *id)
+{
+    char path[MAX_PATH] = {0};
+
+    if (!session_path(path, id, ".part"))
+        return NEXI;
+    DeleteFileA(path);
+    session_path(path, id, ".info");
+    return DeleteFileA(path) ? SUCC : NEXI;
+}
+
+ret_code_t upload_range_begin(const char *target, uint64_t total, char *part)
+{
+    upload_range_file_t *f = NULL;
+
+    f = range_file_find(target);
+    if (f && f->total != total)
+    {
+        log_warn("{%s:%d} range upload [%s] total %llu does not match %llu", __FUNCTION__, __LINE__, target, total, f->total);
+        return PARA;
+    }
+    if (!f)
+    {
+        f = range_file_slot();
+        if (!f)
+            return FULL;
+        f->target = (char*)malloc(strlen(target) + 1);
+        if (!f->target)
+        {
+            log_error("{%s:%d} malloc failed", __FUNCTION__, __LINE__);
+            return FAIL;
+        }
+        memcpy(f->target, target, strlen(target) + 1);
+        f->total = total;
+    }
+    f->writers++;
+    f->active = time(NULL);
+    sprintf(part, "%s.range.part", target);
+    return SUCC;
+}
+
+ret_code_t upload_range_end(const char *target, uint64_t first, uint64_t end, int *done)
+{
+    upload_range_file_t *f = NULL;
+    upload_range_t *ranges = NULL;
+    char part[MAX_PATH] = {0};
+    uint32_t i, j;
+
+    *done = 0;
+    f = range_file_find(target);
+    if (!f)
+        return NEXI;
+    f->writers--;
+    f->active = time(NULL);
+
+    // insert [first, end) and merge it with the ranges it touches
+    if (first < end)
+    {
+        for (i=0; i<f->count && f->ranges[i].end < first; i++);
+        for (j=i; j<f->count && f->ranges[j].first <= end; j++)
+        {
+            if (f->ranges[j].first < first)
+                first = f->ranges[j].first;
+            if (f->ranges[j].end > end)
+                end = f->ranges[j].end;
+        }
+        if (i == j)
+        {
+            ranges = (upload_range_t*)realloc(f->ranges, (f->count + 1) * sizeof(upload_range_t));
+            if (!ranges)
+            {
+                log_error("{%s:%d} realloc failed", __FUNCTION__, __LINE__);
+                return FAIL;
+            }
+            f->ranges = ranges;
+            memmove(f->ranges + i + 1, f->ranges + i, (f->count - i) * sizeof(upload_range_t));
+            f->count++;
+        }
+        else if (j - i > 1)
+        {
+            memmove(f->ranges + i + 1, f->ranges + j, (f->count - j) * sizeof(upload_range_t));
+            f->count -= j - i - 1;
+        }
+        f->ranges[i].first = first;
+        f->ranges[i].end = end;
+    }
+
+    // complete once nothing is being written and a single range covers the file
+    if (f->writers || f->count != 1 || f->ranges[0].first != 0 || f->ranges[0].end != f->total)
+        return SUCC;
+
+    sprintf(part, "%s.range.part", target);
+    if (SUCC != upload_commit(part, target))
+        return FAIL;
+    log_info("{%s:%d} range upload [%s] complete", __FUNCTION__, __LINE__, target);
+    range_file_free(f);
+    *done = 1;
+    return SUCC;
+}
+
+static upload_block_t *alloc_block(upload_t *u)
+{
+    upload_block_t *b = NULL;
+
+    EnterCriticalSection(&_upload_lock);
+    if ((b = _upload_free))
+    {
+        _upload_free = b->next;
+        _upload_nfree--;
+    }
+    LeaveCriticalSection(&_upload_lock);
+    if (!b)
+    {
+        b = (upload_block_t*)malloc(sizeof(upload_block_t));
+        if (!b || !(b->data = (char*)_aligned_malloc(UPLOAD_BLOCK_SIZE, UPLOAD_ALIGN)))
+        {
+            log_error("{%s:%d} malloc failed", __FUNCTION__, __LINE__);
+            free(b);
+            return NULL;
+        }
+    }
+    b->next = NULL;
+    b->u = u;
+    b->offset = u->offset;
+    b->size = 0;
+    return b;
+}
+
+static void free_block(upload_block_t *b)
+{
+    EnterCriticalSection(&_upload_lock);
+    if (_upload_nfree < UPLOAD_FREE_BLOCKS)
+    {
+        b->next = _upload_free;
+        _upload_free = b;
+        _upload_nfree++;
+        b = NULL;
+    }
+    LeaveCriticalSection(&_upload_lock);
+    if (b)
+    {
+        _aligned_free(b->data);
+        free(b);
+    }
+}
+
+static void queue_block(upload_block_t *b)
+{
+    EnterCriticalSection(&_upload_lock);
+    if (_upload_tail)
+        _upload_tail->next = b;
+    else
+        _upload_head = b;
+    _upload_tail = b;
+    if (b != &b->u->closer)
+        b->u->pending++;
+    WakeConditionVariable(&_upload_queued);
+    LeaveCriticalSection(&_upload_lock);
+}
+
+static DWORD write_block(upload_block_t *b)
+{
+    OVERLAPPED ov;
+    DWORD size = b->size;
+    DWORD writen = 0;
+
+    if (b->u->direct)
+        size = (size + UPLOAD_ALIGN - 1) & ~(UPLOAD_ALIGN - 1);
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = (DWORD)b->offset;
+    ov.OffsetHigh = (DWORD)(b->offset >> 32);
+    if (!WriteFile(b->u->handle, b->data, size, &writen, &ov))
+        return GetLastError();
+    if (writen != size)
+        return ERROR_HANDLE_DISK_FULL;
+    return 0;
+}
+
+static void upload_close_begin(upload_t *u)
+{
+    // size of the file once the tail is written
+    u->closer.offset = u->offset + (u->block ? u->block->size : 0);
+    if (u->block)
+    {
+        queue_block(u->block);
+        u->block = NULL;
+    }
+    u->closing = 1;
+    u->closer.next = NULL;
+    u->closer.u = u;
+    u->closer.data = NULL;
+    u->closer.size = 0;
+    // u may be freed by the writer thread from here on when detached
+    queue_block(&u->closer);
+}
+
+static void upload_close_file(upload_t *u)
+{
+    FILE_ALLOCATION_INFO alloc;
+    FILE_END_OF_FILE_INFO eof;
+    uint64_t size = u->closer.offset;
+    uint8_t detached;
+    uint8_t skip;
+    DWORD error = 0;
+
+    // writer thread, every block of u is written
+    EnterCriticalSection(&_upload_lock);
+    skip = u->error || u->cancel;
+    LeaveCriticalSection(&_upload_lock);
+    if (u->handle != INVALID_HANDLE_VALUE)
+    {
+        if (u->direct && !skip)
+        {
+            // the tail was written up to a sector boundary
+            eof.EndOfFile.QuadPart = size;
+            if (!SetFileInformationByHandle(u->handle, FileEndOfFileInfo, &eof, sizeof(eof)))
+                error = GetLastError();
+        }
+        // on disk before the name points to it, the loop keeps serving meanwhile
+        if (UPLOAD_DURABILITY != UPLOAD_SYNC_NONE && !skip && !error && !FlushFileBuffers(u->handle))
+            error = GetLastError();
+        // give back the part of the reservation that was not used, other
+        // writers of a shared file may still be filling it
+        if (u->reserved > size && u->mode != UPLOAD_SHARED)
+        {
+            alloc.AllocationSize.QuadPart = size;
+            SetFileInformationByHandle(u->handle, FileAllocationInfo, &alloc, sizeof(alloc));
+        }
+        CloseHandle(u->handle);
+        u->handle = INVALID_HANDLE_VALUE;
+    }
+    if (u->hash)
+        hash_final(u->hash, &u->digest);
+    else
+        memset(&u->digest, 0, sizeof(hash_digest_t));
+
+    EnterCriticalSection(&_upload_lock);
+    if (error && !u->error)
+        u->error = error;
+    u->closed = 1;
+    detached = u->detached;
+    LeaveCriticalSection(&_upload_lock);
+    if (detached)
+    {
+        free(u->hash);
+        free(u);
+    }
+}
+
+static void upload_release(upload_t *u, int cancel)
+{
+    int closed;
+
+    if (cancel && u->block)
+    {
+        free_block(u->block);
+        u->block = NULL;
+    }
+    EnterCriticalSection(&_upload_lock);
+    if (cancel)
+        u->cancel = 1;
+    u->detached = 1;
+    closed = u->closed;
+    LeaveCriticalSection(&_upload_lock);
+    // never waits for the disk, whoever comes last frees u
+    if (!u->closing)
+        upload_close_begin(u);
+    else if (closed)
+        upload_result(u, NULL);
+}
+
+static DWORD WINAPI upload_proc(LPVOID param)
+{
+    upload_block_t *b = NULL;
+    upload_t *u = NULL;
+    uint8_t skip;
+    DWORD error;
+
+    while (TRUE)
+    {
+        EnterCriticalSection(&_upload_lock);
+        while (!_upload_head && !_upload_stop)
+        {
+            SleepConditionVariableCS(&_upload_queued, &_upload_lock, INFINITE);
+        }
+        if (!_upload_head)
+        {
+            LeaveCriticalSection(&_upload_lock);
+            break;
+        }
+        b = _upload_head;
+        _upload_head = b->next;
+        if (!_upload_head)
+            _upload_tail = NULL;
+        u = b->u;
+        skip = u->cancel || u->error;
+        LeaveCriticalSection(&_upload_lock);
+
+        if (b == &u->closer)
+        {
+            // the last item of u, pending is not counted for it
+            upload_close_file(u);
+            continue;
+        }
+        error = skip || u->handle == INVALID_HANDLE_VALUE ? 0 : write_block(b);
+        // blocks of one upload are written in order, only this thread touches the hash
+        if (!skip && !error && u->hash)
+            hash_update(u->hash, b->data, b->size);
+        free_block(b);
+
+        EnterCriticalSection(&_upload_lock);
+        if (error && !u->error)
+            u->error = error;
+        u->pending--;
+        LeaveCriticalSection(&_upload_lock);
+    }
+    return 0;
+}
+
+static ret_code_t upload_error(DWORD error)
+{
+    if (error == ERROR_DISK_FULL || error == ERROR_HANDLE_DISK_FULL)
+        return FULL;
+    return FAIL;
+}
+
+static int blob_path(char *buf, const uint8_t *sha256)
+{
+    char *p = NULL;
+    int i;
+
+    p = buf + sprintf(buf, "%s%s", root_path(), UPLOAD_BLOB_DIR);
+    if (!CreateDirectoryA(buf, NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+    {
+        log_error("{%s:%d} create [%s] failed. GetLastError=%d", __FUNCTION__, __LINE__, buf, GetLastError());
+        return 0;
+    }
+    *p++ = '/';
+    for (i=0; i<SHA256_SIZE; i++)
+    {
+        *p++ = "0123456789abcdef"[sha256[i] >> 4];
+        *p++ = "0123456789abcdef"[sha256[i] & 0xF];
+    }
+    *p = 0;
+    return 1;
+}
+
+static int blob_verified(const char *blob, const uint8_t *sha256, uint64_t *size)
+{
+    char stored[HASH_DIGEST_LEN] = {0};
+    uint8_t sum[SHA256_SIZE];
+
+    // the stream is only written by the server, from the hash of the bytes it received
+    return SUCC == file_size(blob, size) && SUCC == hash_load(blob, *size, stored)
+        && hash_parse_sha256(stored, sum) && 0 == memcmp(sum, sha256, SHA256_SIZE);
+}
+
+static void blob_sweep()
+{
+    BY_HANDLE_FILE_INFORMATION info;
+    WIN32_FIND_DATAA data;
+    char path[MAX_PATH] = {0};
+    HANDLE find, handle;
+    uint32_t removed = 0;
+    int len;
+
+    // a blob only linked from its own directory is not referenced by any name
+    len = sprintf(path, "%s%s/", root_path(), UPLOAD_BLOB_DIR);
+    memcpy(path + len, "*", 2);
+    find = FindFirstFileA(path, &data);
+    if (find == INVALID_HANDLE_VALUE)
+        return;
+    do
+    {
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY || len + strlen(data.cFileName) >= MAX_PATH)
+            continue;
+        memcpy(path + len, data.cFileName, strlen(data.cFileName) + 1);
+        handle = CreateFileA(path, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+        if (handle == INVALID_HANDLE_VALUE)
+            continue;
+        if (GetFileInformationByHandle(handle, &info) && info.nNumberOfLinks == 1)
+        {
+            CloseHandle(handle);
+            removed += DeleteFileA(path) ? 1 : 0;
+            continue;
+        }
+        CloseHandle(handle);
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+    log_info("{%s:%d} %u unreferenced blobs removed", __FUNCTION__, __LINE__, removed);
+}
+
+static int session_path(char *buf, const char *id, const char *ext)
+{
+    int i;
+
+    // ids are generated here, anything else is rejected
+    for (i=0; id[i]; i++)
+    {
+        if (!((id[i] >= '0' && id[i] <= '9') || (id[i] >= 'a' && id[i] <= 'f')))
+            return 0;
+    }
+    if (i != UPLOAD_SESSION_ID_LEN)
+        return 0;
+    sprintf(buf, "%s%s/%s%s", root_path(), UPLOAD_SESSION_DIR, id, ext);
+    return 1;
+}
+
+static ret_code_t session_read_info(const char *info, uint64_t *length, char *target)
+{
+    char line[MAX_PATH + 2] = {0};
+    FILE *fp = NULL;
+    int len;
+
+    fp = fopen(info, "rb");
+    if (!fp)
+        return NEXI;
+    if (!fgets(line, sizeof(line), fp) || SUCC != str_to_uint64(strtok(line, "\n"), length)
+        || !fgets(target, MAX_PATH, fp))
+    {
+        fclose(fp);
+        return FAIL;
+    }
+    fclose(fp);
+    len = strlen(target);
+    if (len && target[len - 1] == '\n')
+        target[len - 1] = 0;
+    return SUCC;
+}
+
+static ret_code_t file_size(const char *path, uint64_t *size)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &attr))
+        return NEXI;
+    *size = ((uint64_t)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+    return SUCC;
+}
+
+static upload_range_file_t *range_file_find(const char *target)
+{
+    uint32_t i;
+
+    for (i=0; i<UPLOAD_RANGE_FILES; i++)
+    {
+        if (_upload_ranges[i].target && 0 == _stricmp(_upload_ranges[i].target, target))
+            return _upload_ranges + i;
+    }
+    return NULL;
+}
+
+static upload_range_file_t *range_file_slot()
+{
+    upload_range_file_t *oldest = NULL;
+    char part[MAX_PATH] = {0};
+    time_t now = time(NULL);
+    uint32_t i;
+
+    for (i=0; i<UPLOAD_RANGE_FILES; i++)
+    {
+        if (!_upload_ranges[i].target)
+            return _upload_ranges + i;
+        if (!_upload_ranges[i].writers && now - _upload_ranges[i].active >= UPLOAD_RANGE_IDLE
+            && (!oldest || _upload_ranges[i].active < oldest->active))
+            oldest = _upload_ranges + i;
+    }
+    if (!oldest)
+        return NULL;
+
+    // abandoned by its client, the part file goes with the ranges it holds
+    log_warn("{%s:%d} range upload [%s] abandoned", __FUNCTION__, __LINE__, oldest->target);
+    sprintf(part, "%s.range.part", oldest->target);
+    DeleteFileA(part);
+    range_file_free(oldest);
+    return oldest;
+}
+
+static void range_file_free(upload_range_file_t *f)
+{
+    free(f->target);
+    free(f->ranges);
+    memset(f, 0, sizeof(upload_range_file_t));
+}
\ No newline at end of file
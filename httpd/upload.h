@@ -0,0 +1,65 @@
+#ifndef __UPLOAD_H__
+#define __UPLOAD_H__
+
+#define UPLOAD_BLOCK_SIZE       (1024 * 1024)   // writes are coalesced into blocks of this size
+#define UPLOAD_QUEUE_BLOCKS     4               // queued blocks per upload before its socket is paused
+#define UPLOAD_FREE_BLOCKS      16              // idle blocks kept for reuse
+#define UPLOAD_ALIGN            4096            // block alignment, a multiple of the sector size
+#define UPLOAD_DIRECT_IO        0               // FILE_FLAG_NO_BUFFERING, bypass the system cache
+#define UPLOAD_SESSION_DIR      ".uploads"      // resumable upload state under the root path
+#define UPLOAD_SESSION_ID_LEN   32              // hex of 128 random bits
+
+#define UPLOAD_RANGE_FILES      64              // targets with range uploads in progress
+#define UPLOAD_RANGE_IDLE       600             // seconds without a range before a target's slot is taken over
+
+#define UPLOAD_DEDUP            0               // keep each content once under UPLOAD_BLOB_DIR, names are hard links to it
+#define UPLOAD_BLOB_DIR         ".blobs"        // <sha-256 hex>, unreferenced blobs are removed at startup
+
+typedef enum
+{
+    UPLOAD_CREATE           = 0,    // new file, replaces an existing one, hashed while written
+    UPLOAD_APPEND,                  // existing file, continued at the offset
+    UPLOAD_SHARED                   // written by several connections at their own ranges
+} upload_mode_t;
+
+typedef enum
+{
+    UPLOAD_SYNC_NONE        = 0,    // the system cache writes the file back when it likes
+    UPLOAD_SYNC_DATA,               // flushed before it is renamed, a crash never leaves a torn file behind the name
+    UPLOAD_SYNC_FULL                // the rename is flushed as well
+} upload_sync_t;
+
+#define UPLOAD_DURABILITY       UPLOAD_SYNC_DATA
+
+typedef struct upload_t upload_t;
+
+ret_code_t upload_init();
+ret_code_t upload_uninit();
+ret_code_t upload_open(const char *path, upload_mode_t mode, uint64_t offset, uint64_t size, upload_t **u);   // path NULL: only hashed, EXIS: still open by another upload
+ret_code_t upload_write(upload_t *u, const char *data, uint32_t size);
+int        upload_busy(upload_t *u);
+void       upload_close(upload_t *u);     // flushed and closed by the writer thread
+int        upload_closed(upload_t *u);
+ret_code_t upload_result(upload_t *u, hash_digest_t *digest);   // once closed, frees u
+void       upload_detach(upload_t *u);    // closed without waiting, the bytes are kept
+void       upload_abort(upload_t *u);     // closed without waiting, queued bytes are dropped
+ret_code_t upload_commit(const char *temp, const char *target);
+
+// upload state and blobs below the root, never served or written by a request
+int        upload_reserved(const char *path);
+
+// content addressed storage, see UPLOAD_DEDUP. a stored file carries its digest stream
+int        upload_blob_exists(const uint8_t *sha256);
+ret_code_t upload_blob_store(const char *file, const hash_digest_t *digest);
+
+// resumable uploads: <id>.part holds the data received so far, <id>.info the length and target
+ret_code_t upload_session_create(const char *target, uint64_t length, char *id);
+ret_code_t upload_session_query(const char *id, uint64_t *offset, uint64_t *length, char *part);
+ret_code_t upload_session_commit(const char *part, uint64_t *offset, uint64_t *length);
+ret_code_t upload_session_delete(const char *id);
+
+// parallel range uploads of one target into <target>.range.part, committed once every byte is in
+ret_code_t upload_range_begin(const char *target, uint64_t total, char *part);
+ret_code_t upload_range_end(const char *target, uint64_t first, uint64_t end, int *done);
+
+#endif
\ No newline at end of file
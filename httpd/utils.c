@@ -111,10 +111,128 @@ char* root_path()
     return root;
 }
 
-char* uint32_to_str(uint32_t n)
+char* uint64_to_str(uint64_t n)
 {
-    static char buf[16] = {0};
+    static char buf[24] = {0};
     memset(buf, 0, sizeof(buf));
-    _itoa(n, buf, 10);
+    _ui64toa(n, buf, 10);
     return buf;
+}
+
+int uint64_to_buf(uint64_t n, char *buf)
+{
+    char tmp[24];
+    int len = 0;
+    int i;
+
+    do
+    {
+        tmp[len++] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    for (i = 0; i < len; i++)
+    {
+        buf[i] = tmp[len - 1 - i];
+    }
+    buf[len] = 0;
+    return len;
+}
+
+int uint64_to_hex(uint64_t n, char *buf)
+{
+    static const char digits[] = "0123456789abcdef";
+    char tmp[32];
+    int len = 0;
+    int i;
+
+    do
+    {
+        tmp[len++] = digits[n & 0xf];
+        n >>= 4;
+    } while (n);
+    for (i = 0; i < len; i++)
+    {
+        buf[i] = tmp[len - 1 - i];
+    }
+    buf[len] = 0;
+    return len;
+}
+
+int str_to_uint64(const char *str, uint64_t *n)
+{
+    uint64_t v = 0;
+    int digit;
+
+    while (*str == ' ')
+        str++;
+    if (*str < '0' || *str > '9')
+        return PARA;
+    while (*str >= '0' && *str <= '9')
+    {
+        digit = *str++ - '0';
+        if (v > (0xFFFFFFFFFFFFFFFFull - digit) / 10)
+            return FULL;    // overflow
+        v = v * 10 + digit;
+    }
+    while (*str == ' ')
+        str++;
+    if (*str)
+        return PARA;
+    *n = v;
+    return SUCC;
+}
+
+int base64_encode(const uint8_t *data, uint32_t size, char *buf)
+{
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint32_t i, v;
+    char *p = buf;
+
+    for (i=0; i+2<size; i+=3)
+    {
+        v = (uint32_t)data[i] << 16 | (uint32_t)data[i + 1] << 8 | data[i + 2];
+        *p++ = table[v >> 18];
+        *p++ = table[(v >> 12) & 0x3F];
+        *p++ = table[(v >> 6) & 0x3F];
+        *p++ = table[v & 0x3F];
+    }
+    if (i < size)
+    {
+        v = (uint32_t)data[i] << 16 | (i + 1 < size ? (uint32_t)data[i + 1] << 8 : 0);
+        *p++ = table[v >> 18];
+        *p++ = table[(v >> 12) & 0x3F];
+        *p++ = i + 1 < size ? table[(v >> 6) & 0x3F] : '=';
+        *p++ = '=';
+    }
+    *p = 0;
+    return p - buf;
+}
+
+int base64_decode(const char *str, uint8_t *buf, uint32_t size)
+{
+    uint32_t v = 0, bits = 0, len = 0;
+    int c;
+
+    // stops at the first character outside the alphabet, returns -1 when buf is too small
+    for (; *str; str++)
+    {
+        c = *str;
+        if (c >= 'A' && c <= 'Z')       c -= 'A';
+        else if (c >= 'a' && c <= 'z')  c = c - 'a' + 26;
+        else if (c >= '0' && c <= '9')  c = c - '0' + 52;
+        else if (c == '+' || c == '-')  c = 62;
+        else if (c == '/' || c == '_')  c = 63;
+        else
+            break;
+        v = (v << 6) | c;
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            if (len >= size)
+                return -1;
+            buf[len++] = (uint8_t)(v >> bits);
+        }
+    }
+    return len;
 }
\ No newline at end of file
@@ -11,6 +11,11 @@ int file_exist(char *file_name);
 int remove_file(char *file_name);
 char* file_ext(char* file_name);
 char* root_path();
-char* uint32_to_str(uint32_t n);
+char* uint64_to_str(uint64_t n);
+int uint64_to_buf(uint64_t n, char *buf);
+int str_to_uint64(const char *str, uint64_t *n);
+int uint64_to_hex(uint64_t n, char *buf);
+int base64_encode(const uint8_t *data, uint32_t size, char *buf);
+int base64_decode(const char *str, uint8_t *buf, uint32_t size);
 
 #endif
\ No newline at end of file